@@ -25,61 +25,90 @@
 #include <libaudgui/libaudgui.h>
 #include <libaudgui/libaudgui-gtk.h>
 #include <audacious/misc.h>
-#include <bs2b.h>
 
-static t_bs2bdp bs2b = NULL;
-static gint bs2b_channels;
+#include "dsp/dsp.h"
+#include "dsp/params.h"
+
+#define MIN_FEED 10
+#define MAX_FEED 150
+#define MIN_FCUT 300
+#define MAX_FCUT 2000
+
+/* Presets pack the feed level and cut frequency into one integer. */
+#define CLEVEL(feed, fcut) ((feed) << 16 | (fcut))
+#define DEFAULT_CLEVEL CLEVEL (45, 700)
+#define CMOY_CLEVEL CLEVEL (60, 700)
+#define JMEIER_CLEVEL CLEVEL (95, 650)
+
+/* The delay at low frequencies between the direct and crossfed sound, in
+ * microseconds, as libbs2b works it out. */
+#define LEVEL_DELAY(fcut) (18700 / (fcut) * 10)
+
+static DSPCrossfeed crossfeed;
+static gint bs2b_channels, bs2b_rate;
+static DSPParamStore params;
+static gint applied_feed, applied_fcut;
 static GtkWidget *config_window, *feed_slider, *fcut_slider;
 static const gchar * const bs2b_defaults[] = {
  "feed", "45",
  "fcut", "700",
  NULL};
 
-#define feed_level aud_get_int("bs2b", "feed")
-#define fcut_level aud_get_int("bs2b", "fcut")
+/* The filter settings are changed on the audio thread, at the start of the next
+ * block after the sliders move, rather than from the slider callbacks.  The
+ * coefficients are only worked out again when a setting has actually changed. */
+static void update_params (void)
+{
+    DSPParams p = {0};
+    p.s[0] = aud_get_int ("bs2b", "feed");
+    p.s[1] = aud_get_int ("bs2b", "fcut");
+    dsp_params_publish (& params, p);
+}
 
 gboolean init()
 {
     aud_config_set_defaults("bs2b", bs2b_defaults);
-    bs2b = bs2b_open();
-
-    if (bs2b == NULL)
-        return FALSE;
-
-    bs2b_set_level_feed(bs2b, feed_level);
-    bs2b_set_level_fcut(bs2b, fcut_level);
+    update_params();
 
     return TRUE;
 }
 
-static void cleanup()
-{
-    if (bs2b == NULL)
-        return;
-
-    bs2b_close(bs2b);
-    bs2b = NULL;
-}
-
 static void bs2b_start (gint * channels, gint * rate)
 {
-    if (bs2b == NULL)
-        return;
+    DSPParams p = dsp_params_read (& params);
 
     bs2b_channels = * channels;
+    bs2b_rate = * rate;
 
     if (* channels != 2)
         return;
 
-    bs2b_set_srate (bs2b, * rate);
+    applied_feed = p.s[0];
+    applied_fcut = p.s[1];
+    dsp_crossfeed_set (& crossfeed, bs2b_rate, applied_feed, applied_fcut);
+    dsp_crossfeed_clear (& crossfeed);
 }
 
 static void bs2b_process (gfloat * * data, gint * samples)
 {
-    if (bs2b == NULL || bs2b_channels != 2)
+    if (bs2b_channels != 2)
         return;
 
-    bs2b_cross_feed_f (bs2b, * data, (* samples) / 2);
+    DSPParams p = dsp_params_read (& params);
+
+    if (p.s[0] != applied_feed || p.s[1] != applied_fcut)
+    {
+        applied_feed = p.s[0];
+        applied_fcut = p.s[1];
+        dsp_crossfeed_set (& crossfeed, bs2b_rate, applied_feed, applied_fcut);
+    }
+
+    dsp_crossfeed (& crossfeed, * data, (* samples) / 2);
+}
+
+static void bs2b_flush (void)
+{
+    dsp_crossfeed_clear (& crossfeed);
 }
 
 static void bs2b_finish (gfloat * * data, gint * samples)
@@ -90,7 +119,7 @@ static void bs2b_finish (gfloat * * data, gint * samples)
 static void feed_value_changed(GtkRange *range, gpointer data)
 {
     aud_set_int("bs2b", "feed", gtk_range_get_value(range));
-    bs2b_set_level_feed(bs2b, feed_level);
+    update_params();
 }
 
 static gchar *feed_format_value(GtkScale *scale, gdouble value)
@@ -101,12 +130,12 @@ static gchar *feed_format_value(GtkScale *scale, gdouble value)
 static void fcut_value_changed(GtkRange *range, gpointer data)
 {
     aud_set_int("bs2b", "fcut", gtk_range_get_value(range));
-    bs2b_set_level_fcut(bs2b, fcut_level);
+    update_params();
 }
 
 static gchar *fcut_format_value(GtkScale *scale, gdouble value)
 {
-    return g_strdup_printf("%d Hz, %dµs", (int) value, bs2b_level_delay((int) value));
+    return g_strdup_printf("%d Hz, %dµs", (int) value, LEVEL_DELAY((int) value));
 }
 
 static void preset_button_clicked(GtkButton *button, gpointer data)
@@ -146,8 +175,8 @@ static void configure (void)
 
         gtk_box_pack_start(GTK_BOX(hbox), gtk_label_new(_("Feed level:")), TRUE, FALSE, 0);
 
-        feed_slider = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, BS2B_MINFEED, BS2B_MAXFEED, 1.0);
-        gtk_range_set_value (GTK_RANGE(feed_slider), feed_level);
+        feed_slider = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, MIN_FEED, MAX_FEED, 1.0);
+        gtk_range_set_value (GTK_RANGE(feed_slider), aud_get_int ("bs2b", "feed"));
         gtk_widget_set_size_request (feed_slider, 200, -1);
         gtk_box_pack_start ((GtkBox *) hbox, feed_slider, FALSE, FALSE, 0);
         g_signal_connect (feed_slider, "value-changed", (GCallback) feed_value_changed,
@@ -160,8 +189,8 @@ static void configure (void)
 
         gtk_box_pack_start (GTK_BOX(hbox), gtk_label_new(_("Cut frequency:")), TRUE, FALSE, 0);
 
-        fcut_slider = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, BS2B_MINFCUT, BS2B_MAXFCUT, 1.0);
-        gtk_range_set_value (GTK_RANGE(fcut_slider), fcut_level);
+        fcut_slider = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, MIN_FCUT, MAX_FCUT, 1.0);
+        gtk_range_set_value (GTK_RANGE(fcut_slider), aud_get_int ("bs2b", "fcut"));
         gtk_widget_set_size_request (fcut_slider, 200, -1);
         gtk_box_pack_start ((GtkBox *) hbox, fcut_slider, FALSE, FALSE, 0);
         g_signal_connect (fcut_slider, "value-changed", (GCallback) fcut_value_changed,
@@ -174,13 +203,13 @@ static void configure (void)
 
         gtk_box_pack_start ((GtkBox *) hbox, gtk_label_new(_("Presets:")), TRUE, FALSE, 0);
 
-        button = preset_button(_("Default"), BS2B_DEFAULT_CLEVEL);
+        button = preset_button(_("Default"), DEFAULT_CLEVEL);
         gtk_box_pack_start ((GtkBox *) hbox, button, TRUE, FALSE, 0);
 
-        button = preset_button("C. Moy", BS2B_CMOY_CLEVEL);
+        button = preset_button("C. Moy", CMOY_CLEVEL);
         gtk_box_pack_start ((GtkBox *) hbox, button, TRUE, FALSE, 0);
 
-        button = preset_button("J. Meier", BS2B_JMEIER_CLEVEL);
+        button = preset_button("J. Meier", JMEIER_CLEVEL);
         gtk_box_pack_start ((GtkBox *) hbox, button, TRUE, FALSE, 0);
 
         g_signal_connect (config_window, "response", (GCallback) gtk_widget_destroy, NULL);
@@ -197,10 +226,10 @@ AUD_EFFECT_PLUGIN
     .name = N_("Bauer Stereophonic-to-Binaural (BS2B)"),
     .domain = PACKAGE,
     .init = init,
-    .cleanup = cleanup,
     .configure = configure,
     .start = bs2b_start,
     .process = bs2b_process,
+    .flush = bs2b_flush,
     .finish = bs2b_finish,
     .preserves_format = TRUE
 )
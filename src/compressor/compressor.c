@@ -24,6 +24,8 @@
 #include <audacious/misc.h>
 
 #include "compressor.h"
+#include "dsp/dsp.h"
+#include "dsp/params.h"
 
 /* Response time adjustments.  Maybe this should be adjustable.  Or maybe that
  * would just be confusing.  I don't know. */
@@ -40,6 +42,16 @@ static int ring_at, buffer_filled, peaks_filled;
 static float current_peak;
 static int output_filled;
 static int current_channels, current_rate;
+static int use_limiter;
+static DSPParamStore params;
+
+void compressor_update_params (void)
+{
+    DSPParams p = {0};
+    p.f[0] = aud_get_double ("compressor", "center");
+    p.f[1] = aud_get_double ("compressor", "range");
+    dsp_params_publish (& params, p);
+}
 
 static void buffer_append (float * * data, int * length)
 {
@@ -72,27 +84,18 @@ static float calc_peak (float * data, int length)
     if (! length)
         return 0;
 
-    float sum = 0;
-
-    float * end = data + length;
-    while (data < end)
-        sum += fabsf (* data ++);
-
-    return sum / length * 6;
+    return dsp_abs_sum (data, length) / length * 6;
 }
 
 static void do_ramp (float * data, int length, float peak_a, float peak_b)
 {
-    float center = aud_get_double ("compressor", "center");
-    float range = aud_get_double ("compressor", "range");
+    DSPParams p = dsp_params_read (& params);
+    float center = p.f[0];
+    float range = p.f[1];
     float a = powf (peak_a / center, range - 1);
     float b = powf (peak_b / center, range - 1);
 
-    for (int count = 0; count < length; count ++)
-    {
-        * data = (* data) * (a * (length - count) + b * count) / length;
-        data ++;
-    }
+    dsp_ramp (data, length, a, b);
 }
 
 static void output_append (float * data, int length)
@@ -189,6 +192,8 @@ static void do_compress (float * * data, int * samples, char finish)
 int compressor_init (void)
 {
     compressor_config_load ();
+    compressor_update_params ();
+    limiter_update_params ();
 
     buffer = NULL;
     output = NULL;
@@ -203,10 +208,20 @@ void compressor_cleanup (void)
     free (buffer);
     free (output);
     free (peaks);
+
+    limiter_cleanup ();
 }
 
 void compressor_start (int * channels, int * rate)
 {
+    use_limiter = (aud_get_int ("compressor", "mode") == 1);
+
+    if (use_limiter)
+    {
+        limiter_start (* channels, * rate);
+        return;
+    }
+
     chunk_size = (* channels) * (int) ((* rate) * CHUNK_TIME);
     buffer_size = chunk_size * CHUNKS;
     buffer = realloc (buffer, sizeof (float) * buffer_size);
@@ -220,20 +235,32 @@ void compressor_start (int * channels, int * rate)
 
 void compressor_process (float * * data, int * samples)
 {
-    do_compress (data, samples, 0);
+    if (use_limiter)
+        limiter_process (data, samples, 0);
+    else
+        do_compress (data, samples, 0);
 }
 
 void compressor_flush (void)
 {
-    reset ();
+    if (use_limiter)
+        limiter_flush ();
+    else
+        reset ();
 }
 
 void compressor_finish (float * * data, int * samples)
 {
-    do_compress (data, samples, 1);
+    if (use_limiter)
+        limiter_process (data, samples, 1);
+    else
+        do_compress (data, samples, 1);
 }
 
 int compressor_adjust_delay (int delay)
 {
+    if (use_limiter)
+        return limiter_adjust_delay (delay);
+
     return delay + (int64_t) (buffer_filled / current_channels) * 1000 / current_rate;
 }
@@ -18,6 +18,7 @@
  */
 
 void compressor_config_load (void);
+void compressor_update_params (void);
 
 int compressor_init (void);
 void compressor_cleanup (void);
@@ -26,3 +27,10 @@ void compressor_process (float * * data, int * samples);
 void compressor_flush (void);
 void compressor_finish (float * * data, int * samples);
 int compressor_adjust_delay (int delay);
+
+void limiter_update_params (void);
+void limiter_start (int channels, int rate);
+void limiter_process (float * * data, int * samples, int finish);
+void limiter_flush (void);
+int limiter_adjust_delay (int delay);
+void limiter_cleanup (void);
@@ -0,0 +1,260 @@
+/*
+ * Look-Ahead Limiter for the Dynamic Range Compression Plugin
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <audacious/misc.h>
+
+#include "compressor.h"
+#include "dsp/dsp.h"
+#include "dsp/params.h"
+
+/* Unlike the compressor, which adjusts the volume gradually over whole seconds,
+ * the limiter makes sure that no peak ever goes above the ceiling.  The audio
+ * is delayed by a short look-ahead time, so that the gain can be brought down
+ * smoothly before each peak arrives instead of cutting it off.
+ *
+ * For each frame, the true peak (including any peaks between the samples,
+ * found by 4x oversampling) gives the gain needed for that frame.  A sliding
+ * window minimum of the needed gain, taken with a monotonic queue, is then
+ * smoothed with a moving average as long as the look-ahead.  Because every value
+ * in the average is already low enough for the peak, so is their average, and
+ * the gain changes over the look-ahead time instead of all at once. */
+
+#define RELEASE 0.05 /* seconds */
+
+static float tp_filter[(DSP_TP_PHASES - 1) * DSP_TP_TAPS];
+static float * history; /* last DSP_TP_TAPS samples of each channel, twice over */
+static int history_at;
+
+static float * delay; /* delay_frames frames, used as a ring */
+static int delay_frames, lookahead;
+
+/* monotonic queue of the highest peaks in the look-ahead window */
+static int64_t * queue_index;
+static float * queue_peak;
+static int queue_head, queue_count, queue_size;
+
+static float * gains; /* the last <lookahead> gains, used as a ring */
+static double gain_sum;
+static float release_gain, release_coef;
+
+static int64_t steps;
+static int current_channels, current_rate;
+static float * output;
+static int output_size;
+static DSPParamStore params;
+
+void limiter_update_params (void)
+{
+    DSPParams p = {0};
+    p.f[0] = aud_get_double ("compressor", "ceiling");
+    dsp_params_publish (& params, p);
+}
+
+/* Adds one frame to the history and returns the true peak of the frame
+ * DSP_TP_HALF frames back. */
+static float true_peak (const float * frame)
+{
+    float peak = 0;
+
+    for (int c = 0; c < current_channels; c ++)
+    {
+        float * h = history + 2 * DSP_TP_TAPS * c;
+
+        h[history_at] = h[history_at + DSP_TP_TAPS] = frame[c];
+        peak = fmaxf (peak, dsp_true_peak (h + history_at + 1, tp_filter));
+    }
+
+    history_at = (history_at + 1) % DSP_TP_TAPS;
+    return peak;
+}
+
+/* Adds the peak of frame <index> and returns the highest peak of that frame
+ * and the <lookahead> frames before it. */
+static float window_peak (int64_t index, float peak)
+{
+    while (queue_count && queue_index[queue_head] <= index - queue_size)
+    {
+        queue_head = (queue_head + 1) % queue_size;
+        queue_count --;
+    }
+
+    while (queue_count && queue_peak[(queue_head + queue_count - 1) %
+     queue_size] <= peak)
+        queue_count --;
+
+    int at = (queue_head + queue_count) % queue_size;
+    queue_index[at] = index;
+    queue_peak[at] = peak;
+    queue_count ++;
+
+    return queue_peak[queue_head];
+}
+
+void limiter_flush (void)
+{
+    memset (history, 0, sizeof (float) * 2 * DSP_TP_TAPS * current_channels);
+    history_at = 0;
+
+    memset (delay, 0, sizeof (float) * delay_frames * current_channels);
+
+    queue_head = queue_count = 0;
+
+    for (int i = 0; i < lookahead; i ++)
+        gains[i] = 1;
+
+    gain_sum = lookahead;
+    release_gain = 1;
+    steps = 0;
+}
+
+void limiter_start (int channels, int rate)
+{
+    int ms = aud_get_int ("compressor", "lookahead");
+    ms = (ms < 1) ? 1 : (ms > 10) ? 10 : ms;
+    lookahead = rate * ms / 1000;
+    lookahead = (lookahead < 1) ? 1 : lookahead;
+
+    /* the true peak of each frame is known DSP_TP_HALF frames late */
+    delay_frames = lookahead + DSP_TP_HALF;
+    queue_size = lookahead + 1;
+
+    current_channels = channels;
+    current_rate = rate;
+    release_coef = 1 - expf (-1 / (RELEASE * rate));
+
+    dsp_true_peak_filter (tp_filter);
+
+    history = realloc (history, sizeof (float) * 2 * DSP_TP_TAPS * channels);
+    delay = realloc (delay, sizeof (float) * delay_frames * channels);
+    queue_index = realloc (queue_index, sizeof (int64_t) * queue_size);
+    queue_peak = realloc (queue_peak, sizeof (float) * queue_size);
+    gains = realloc (gains, sizeof (float) * lookahead);
+
+    limiter_flush ();
+}
+
+/* Runs one frame through the limiter; the delayed frame comes out in <out>. */
+static void limit_frame (const float * in, float * out, float ceiling)
+{
+    float peak = window_peak (steps - DSP_TP_HALF, true_peak (in));
+    float gain = (peak > ceiling) ? ceiling / peak : 1;
+
+    if (gain < release_gain)
+        release_gain = gain;
+    else
+        release_gain += (gain - release_gain) * release_coef;
+
+    int at = steps % lookahead;
+    gain_sum += release_gain - gains[at];
+    gains[at] = release_gain;
+
+    /* never let rounding in the running sum push the gain above the target */
+    float smooth = fminf (gain_sum / lookahead, 1);
+
+    float * slot = delay + current_channels * (steps % delay_frames);
+
+    for (int c = 0; c < current_channels; c ++)
+    {
+        out[c] = slot[c] * smooth;
+        slot[c] = in[c];
+    }
+
+    steps ++;
+}
+
+void limiter_process (float * * data, int * samples, int finish)
+{
+    int channels = current_channels;
+    int frames = * samples / channels;
+    int max = frames + (finish ? delay_frames : 0);
+
+    if (output_size < channels * max)
+    {
+        output_size = channels * max;
+        output = realloc (output, sizeof (float) * output_size);
+    }
+
+    float ceiling = dsp_params_read (& params).f[0];
+    float * in = * data;
+    float * out = output;
+    float silence[channels];
+    float frame[channels];
+
+    memset (silence, 0, sizeof silence);
+
+    for (int f = 0; f < frames; f ++)
+    {
+        /* the first frames out of the delay line are not part of the song */
+        if (steps < delay_frames)
+        {
+            limit_frame (in + channels * f, frame, ceiling);
+            continue;
+        }
+
+        limit_frame (in + channels * f, out, ceiling);
+        out += channels;
+    }
+
+    /* At the end of the song, push silence through to get the held frames. */
+    if (finish)
+    {
+        int held = (steps < delay_frames) ? steps : delay_frames;
+
+        for (int f = 0; f < delay_frames; f ++)
+        {
+            if (f < delay_frames - held)
+                limit_frame (silence, frame, ceiling);
+            else
+            {
+                limit_frame (silence, out, ceiling);
+                out += channels;
+            }
+        }
+
+        limiter_flush ();
+    }
+
+    * data = output;
+    * samples = out - output;
+}
+
+int limiter_adjust_delay (int delay)
+{
+    int held = (steps < delay_frames) ? steps : delay_frames;
+    return delay + (int64_t) held * 1000 / current_rate;
+}
+
+void limiter_cleanup (void)
+{
+    free (history);
+    free (delay);
+    free (queue_index);
+    free (queue_peak);
+    free (gains);
+    free (output);
+
+    history = delay = queue_peak = gains = output = NULL;
+    queue_index = NULL;
+    output_size = 0;
+}
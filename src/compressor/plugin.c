@@ -29,16 +29,36 @@
 static const char * const compressor_defaults[] = {
  "center", "0.5",
  "range", "0.5",
+ "mode", "0",
+ "lookahead", "5",
+ "ceiling", "0.95",
  NULL};
 
+static const ComboBoxElements mode_list[] = {
+ {"0", N_("Compressor")},
+ {"1", N_("Look-ahead limiter")}};
+
 static const PreferencesWidget compressor_widgets[] = {
+ {WIDGET_COMBO_BOX, N_("Mode:"),
+  .cfg_type = VALUE_STRING, .csect = "compressor", .cname = "mode",
+  .data = {.combo = {mode_list, sizeof mode_list / sizeof mode_list[0]}}},
  {WIDGET_LABEL, N_("<b>Compression</b>")},
  {WIDGET_SPIN_BTN, N_("Center volume:"),
   .cfg_type = VALUE_FLOAT, .csect = "compressor", .cname = "center",
+  .callback = compressor_update_params,
   .data = {.spin_btn = {0.1, 1, 0.1}}},
  {WIDGET_SPIN_BTN, N_("Dynamic range:"),
   .cfg_type = VALUE_FLOAT, .csect = "compressor", .cname = "range",
-  .data = {.spin_btn = {0.0, 3.0, 0.1}}}};
+  .callback = compressor_update_params,
+  .data = {.spin_btn = {0.0, 3.0, 0.1}}},
+ {WIDGET_LABEL, N_("<b>Limiting</b>")},
+ {WIDGET_SPIN_BTN, N_("Look-ahead:"),
+  .cfg_type = VALUE_INT, .csect = "compressor", .cname = "lookahead",
+  .data = {.spin_btn = {1, 10, 1, N_("ms")}}},
+ {WIDGET_SPIN_BTN, N_("Ceiling:"),
+  .cfg_type = VALUE_FLOAT, .csect = "compressor", .cname = "ceiling",
+  .callback = limiter_update_params,
+  .data = {.spin_btn = {0.1, 1, 0.01}}}};
 
 static const PluginPreferences compressor_prefs = {
  .widgets = compressor_widgets,
@@ -0,0 +1,692 @@
+/*
+ * Convolver Plugin for Audacious
+ * Copyright 2013 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/* Convolves the audio with an impulse response read from a file, as used for
+ * room correction or to place the listener in a recorded space.  The impulse
+ * response is cut into partitions of one block each and the convolution is
+ * done block by block in the frequency domain (uniformly partitioned
+ * overlap-save), so the cost per frame hardly grows with the length of the
+ * impulse response and the added latency is a single block. */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <sndfile.h>
+
+#include <audacious/i18n.h>
+#include <audacious/misc.h>
+#include <audacious/plugin.h>
+#include <audacious/preferences.h>
+
+#include "dsp/dsp.h"
+
+#define MAX_THREADS 8
+
+/* Impulse responses are cut off after this long. */
+#define MAX_LENGTH 10 /* seconds */
+
+/* The first few partitions of each channel are done by the audio thread as
+ * each block comes in.  The rest of the impulse response (the tail) is only
+ * ever applied to input at least HEAD_PARTITIONS blocks old, so it is done one
+ * block ahead by the worker threads, while the audio thread gets on with
+ * filling the next block.  The tail is split into as many slices as there are
+ * worker threads, so that a long one is spread across all of them. */
+#define HEAD_PARTITIONS 4
+
+static const char * const conv_defaults[] = {
+ "file", "",
+ "threads", "2",
+ NULL};
+
+static void update_params (void);
+
+static const PreferencesWidget conv_widgets[] = {
+ {WIDGET_LABEL, N_("<b>Impulse Response</b>")},
+ {WIDGET_ENTRY, N_("File:"),
+  .cfg_type = VALUE_STRING, .csect = "convolver", .cname = "file",
+  .callback = update_params},
+ {WIDGET_LABEL, N_("<b>Performance</b>")},
+ {WIDGET_SPIN_BTN, N_("Threads:"),
+  .cfg_type = VALUE_INT, .csect = "convolver", .cname = "threads",
+  .callback = update_params,
+  .data = {.spin_btn = {1, MAX_THREADS, 1}}}};
+
+static const PluginPreferences conv_prefs = {
+ .widgets = conv_widgets,
+ .n_widgets = sizeof conv_widgets / sizeof conv_widgets[0]};
+
+/* Everything that depends on the impulse response and on the format of the
+ * stream.  It is put together by the loader thread and handed to the audio
+ * thread whole, so that the audio thread never reads a file, resamples, or
+ * starts a thread itself. */
+typedef struct Conv {
+    int channels, rate; /* of the stream it was made for */
+
+    /* Each block is <block> frames long and is transformed together with the
+     * block before it, <block> * 2 samples in all, which gives <block> + 1
+     * bins.  A spectrum takes up <spectrum> floats. */
+    int block, bins, spectrum;
+    DSPFFT * fft;
+
+    /* the impulse response, as <partitions> spectra for each of its channels;
+     * <partitions> is 0 if there is no impulse response to apply */
+    int ir_channels, partitions;
+    float * ir_spectra;
+
+    /* For each channel: the spectra of the last <partitions> blocks of input
+     * (a ring, the newest at <newest>), the time domain input for the next
+     * transform, and the output being played while the next block fills up. */
+    float * history;
+    int newest;
+    float * input, * output;
+    int fill;
+
+    /* For each channel: one accumulated spectrum for the head, and one for
+     * each slice of the tail.  The tail sums are for the next block, counting
+     * from <tail_newest>, and are being worked on while <tail_running> is
+     * set. */
+    DSPWorkers * workers;
+    int tail_slices, tail_newest;
+    bool_t tail_running;
+    float * sums, * tail_sums;
+
+    float * work;
+
+    struct Conv * next; /* in the retired list */
+} Conv;
+
+/* The loader thread reads the file whenever the settings change, and prepares
+ * the impulse response for the format which the audio thread asks for in
+ * conv_start().  A finished Conv is published in <pending>, and the audio
+ * thread switches to it between blocks.  The one it replaces goes back to the
+ * loader thread to be freed.  Until the first one for a new format is ready,
+ * the audio passes through unchanged. */
+static pthread_t loader;
+static pthread_mutex_t loader_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t loader_cond = PTHREAD_COND_INITIALIZER;
+
+/* protected by loader_mutex */
+static int want_serial, want_channels, want_rate;
+static Conv * retired;
+static bool_t loader_quit;
+
+/* the impulse response as read from the file, loader thread only */
+static float * ir_data;
+static int ir_frames, ir_file_channels, ir_file_rate;
+
+static Conv * pending; /* handed from the loader thread to the audio thread */
+static Conv * active; /* audio thread only */
+static int conv_channels, conv_rate; /* audio thread only */
+
+static float * finish_buffer;
+static int finish_samples;
+
+static void wait_tail (Conv * v)
+{
+    if (v->tail_running)
+    {
+        dsp_workers_wait (v->workers);
+        v->tail_running = FALSE;
+    }
+}
+
+static void conv_free (Conv * v)
+{
+    if (! v)
+        return;
+
+    if (v->workers)
+    {
+        wait_tail (v);
+        dsp_workers_free (v->workers);
+    }
+
+    if (v->fft)
+        dsp_fft_free (v->fft);
+
+    free (v->ir_spectra);
+    free (v->history);
+    free (v->input);
+    free (v->output);
+    free (v->sums);
+    free (v->tail_sums);
+    free (v->work);
+    free (v);
+}
+
+/* Reads the impulse response into <ir_data>, at the rate of the file. */
+static void read_ir (void)
+{
+    free (ir_data);
+    ir_data = NULL;
+    ir_frames = 0;
+
+    char * path = aud_get_string ("convolver", "file");
+
+    if (! path[0])
+    {
+        g_free (path);
+        return;
+    }
+
+    SF_INFO info = {0};
+    SNDFILE * file = sf_open (path, SFM_READ, & info);
+
+    if (! file)
+    {
+        fprintf (stderr, "convolver: Cannot open %s: %s.\n", path,
+         sf_strerror (NULL));
+        g_free (path);
+        return;
+    }
+
+    int frames = MIN (info.frames, (sf_count_t) info.samplerate * MAX_LENGTH);
+    float * buf = malloc (sizeof (float) * info.channels * MAX (frames, 1));
+
+    frames = sf_readf_float (file, buf, frames);
+    sf_close (file);
+
+    if (frames <= 0 || info.samplerate <= 0)
+    {
+        fprintf (stderr, "convolver: Cannot read %s.\n", path);
+        free (buf);
+        g_free (path);
+        return;
+    }
+
+    g_free (path);
+
+    ir_data = buf;
+    ir_frames = frames;
+    ir_file_channels = info.channels;
+    ir_file_rate = info.samplerate;
+}
+
+/* Brings the impulse response to the stream's rate.  Returns the number of
+ * frames. */
+static int resample_ir (int rate, float * * data)
+{
+    if (ir_file_rate == rate)
+    {
+        * data = ir_data;
+        return ir_frames;
+    }
+
+    int frames = (int64_t) ir_frames * rate / ir_file_rate;
+    frames = MAX (frames, 1);
+
+    float * resampled = malloc (sizeof (float) * ir_file_channels * frames);
+    dsp_resample (ir_data, ir_frames, resampled, frames, ir_file_channels);
+
+    /* Each frame now covers less (or more) time, so the sum over the impulse
+     * response must be scaled to keep the same gain. */
+    float scale = (float) ir_file_rate / rate;
+    for (int i = 0; i < ir_file_channels * frames; i ++)
+        resampled[i] *= scale;
+
+    * data = resampled;
+    return frames;
+}
+
+static Conv * conv_new (int channels, int rate)
+{
+    Conv * v = calloc (1, sizeof (Conv));
+
+    v->channels = channels;
+    v->rate = rate;
+
+    if (! ir_frames)
+        return v;
+
+    float * data;
+    int frames = resample_ir (rate, & data);
+
+    /* the smallest power of two covering 10 ms */
+    for (v->block = 64; v->block < rate / 100; v->block <<= 1)
+        ;
+
+    int block = v->block;
+
+    v->bins = block + 1;
+    v->spectrum = 2 * v->bins;
+    v->ir_channels = ir_file_channels;
+    v->partitions = (frames + block - 1) / block;
+    v->fft = dsp_fft_new (2 * block);
+
+    int spectrum = v->spectrum;
+    int partitions = v->partitions;
+
+    v->ir_spectra = malloc (sizeof (float) * v->ir_channels * partitions *
+     spectrum);
+    v->work = malloc (sizeof (float) * 2 * block);
+
+    for (int c = 0; c < v->ir_channels; c ++)
+    {
+        for (int p = 0; p < partitions; p ++)
+        {
+            int start = p * block;
+            int length = MIN (block, frames - start);
+
+            memset (v->work, 0, sizeof (float) * 2 * block);
+            for (int f = 0; f < length; f ++)
+                v->work[f] = data[v->ir_channels * (start + f) + c];
+
+            dsp_fft_forward (v->fft, v->work, v->ir_spectra + (c * partitions +
+             p) * spectrum);
+        }
+    }
+
+    if (data != ir_data)
+        free (data);
+
+    /* With a single thread, the tail is done by the audio thread after all. */
+    int threads = CLAMP (aud_get_int ("convolver", "threads"), 1, MAX_THREADS);
+    int tail = MAX (partitions - HEAD_PARTITIONS, 0);
+
+    v->tail_slices = MIN (MAX (threads - 1, 1), tail);
+    v->workers = dsp_workers_new (MIN (threads, channels * v->tail_slices + 1));
+
+    v->history = calloc (channels * partitions * spectrum, sizeof (float));
+    v->input = calloc (channels * 2 * block, sizeof (float));
+    v->output = calloc (channels * block, sizeof (float));
+    v->sums = malloc (sizeof (float) * channels * spectrum);
+    v->tail_sums = calloc (channels * MAX (v->tail_slices, 1) * spectrum,
+     sizeof (float));
+
+    return v;
+}
+
+static void * loader_thread (void * unused)
+{
+    int read_serial = 0;
+    int built_serial = 0, built_channels = 0, built_rate = 0;
+
+    pthread_mutex_lock (& loader_mutex);
+
+    while (! loader_quit)
+    {
+        if (retired)
+        {
+            Conv * list = retired;
+            retired = NULL;
+
+            pthread_mutex_unlock (& loader_mutex);
+
+            while (list)
+            {
+                Conv * next = list->next;
+                conv_free (list);
+                list = next;
+            }
+
+            pthread_mutex_lock (& loader_mutex);
+            continue;
+        }
+
+        int serial = want_serial;
+        int channels = want_channels;
+        int rate = want_rate;
+
+        /* The file is read as soon as it is chosen, before a stream is even
+         * started. */
+        if (serial != read_serial)
+        {
+            pthread_mutex_unlock (& loader_mutex);
+            read_ir ();
+            pthread_mutex_lock (& loader_mutex);
+
+            read_serial = serial;
+            continue;
+        }
+
+        if (rate && (serial != built_serial || channels != built_channels ||
+         rate != built_rate))
+        {
+            pthread_mutex_unlock (& loader_mutex);
+
+            /* one which the audio thread never picked up can go right away */
+            Conv * v = conv_new (channels, rate);
+            conv_free (__atomic_exchange_n (& pending, v, __ATOMIC_ACQ_REL));
+
+            pthread_mutex_lock (& loader_mutex);
+
+            built_serial = serial;
+            built_channels = channels;
+            built_rate = rate;
+            continue;
+        }
+
+        pthread_cond_wait (& loader_cond, & loader_mutex);
+    }
+
+    pthread_mutex_unlock (& loader_mutex);
+    return NULL;
+}
+
+static void update_params (void)
+{
+    pthread_mutex_lock (& loader_mutex);
+    want_serial ++;
+    pthread_cond_signal (& loader_cond);
+    pthread_mutex_unlock (& loader_mutex);
+}
+
+static bool_t conv_init (void)
+{
+    aud_config_set_defaults ("convolver", conv_defaults);
+
+    want_serial = 1;
+    want_channels = want_rate = 0;
+    loader_quit = FALSE;
+
+    if (pthread_create (& loader, NULL, loader_thread, NULL))
+    {
+        fprintf (stderr, "convolver: Cannot start loader thread.\n");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void conv_cleanup (void)
+{
+    pthread_mutex_lock (& loader_mutex);
+    loader_quit = TRUE;
+    pthread_cond_signal (& loader_cond);
+    pthread_mutex_unlock (& loader_mutex);
+
+    pthread_join (loader, NULL);
+
+    conv_free (__atomic_exchange_n (& pending, NULL, __ATOMIC_ACQ_REL));
+    conv_free (active);
+    active = NULL;
+
+    while (retired)
+    {
+        Conv * next = retired->next;
+        conv_free (retired);
+        retired = next;
+    }
+
+    free (ir_data);
+    ir_data = NULL;
+    ir_frames = 0;
+
+    free (finish_buffer);
+    finish_buffer = NULL;
+    finish_samples = 0;
+
+    conv_channels = conv_rate = 0;
+}
+
+/* Hands <v> back to the loader thread to be freed.  Audio thread only. */
+static void retire (Conv * v)
+{
+    pthread_mutex_lock (& loader_mutex);
+    v->next = retired;
+    retired = v;
+    pthread_cond_signal (& loader_cond);
+    pthread_mutex_unlock (& loader_mutex);
+}
+
+/* Switches to the latest Conv from the loader thread, if there is a new one
+ * for the current format. */
+static void adopt (void)
+{
+    Conv * next = __atomic_exchange_n (& pending, NULL, __ATOMIC_ACQ_REL);
+
+    if (! next)
+        return;
+
+    if (next->channels != conv_channels || next->rate != conv_rate)
+    {
+        retire (next);
+        return;
+    }
+
+    if (active)
+        retire (active);
+
+    active = next;
+}
+
+static void conv_start (int * channels, int * rate)
+{
+    if (* channels == conv_channels && * rate == conv_rate)
+        return;
+
+    conv_channels = * channels;
+    conv_rate = * rate;
+
+    if (active)
+    {
+        retire (active);
+        active = NULL;
+    }
+
+    pthread_mutex_lock (& loader_mutex);
+    want_channels = conv_channels;
+    want_rate = conv_rate;
+    pthread_cond_signal (& loader_cond);
+    pthread_mutex_unlock (& loader_mutex);
+}
+
+/* Adds up partitions <first> to <last> - 1 of the convolution for one channel
+ * into <acc>, for the block whose input is at <latest> in the history. */
+static void convolve_range (Conv * v, int c, int latest, int first, int last,
+ float * acc)
+{
+    int partitions = v->partitions;
+    int spectrum = v->spectrum;
+
+    const float * ir = v->ir_spectra + (c % v->ir_channels) * partitions *
+     spectrum;
+    const float * hist = v->history + c * partitions * spectrum;
+
+    memset (acc, 0, sizeof (float) * spectrum);
+
+    for (int p = first; p < last; p ++)
+    {
+        int age = (latest - p + partitions) % partitions;
+        dsp_spectrum_mac (acc, hist + age * spectrum, ir + p * spectrum, v->bins);
+    }
+}
+
+/* Job <index> covers slice <index> % <tail_slices> of the tail of channel
+ * <index> / <tail_slices>. */
+static void run_tail (void * data, int index)
+{
+    Conv * v = data;
+    int c = index / v->tail_slices;
+    int s = index % v->tail_slices;
+    int tail = v->partitions - HEAD_PARTITIONS;
+    int first = HEAD_PARTITIONS + tail * s / v->tail_slices;
+    int last = HEAD_PARTITIONS + tail * (s + 1) / v->tail_slices;
+
+    convolve_range (v, c, v->tail_newest, first, last, v->tail_sums + index *
+     v->spectrum);
+}
+
+static void run_block (Conv * v)
+{
+    int block = v->block;
+    int spectrum = v->spectrum;
+
+    /* The tail for this block was started along with the last one, and has
+     * most likely been finished for some time. */
+    wait_tail (v);
+
+    v->newest = (v->newest + 1) % v->partitions;
+
+    for (int c = 0; c < v->channels; c ++)
+    {
+        float * in = v->input + c * 2 * block;
+        float * acc = v->sums + c * spectrum;
+
+        dsp_fft_forward (v->fft, in, v->history + (c * v->partitions +
+         v->newest) * spectrum);
+
+        convolve_range (v, c, v->newest, 0, MIN (v->partitions,
+         HEAD_PARTITIONS), acc);
+
+        for (int s = 0; s < v->tail_slices; s ++)
+            dsp_mix (acc, v->tail_sums + (c * v->tail_slices + s) * spectrum,
+             spectrum);
+
+        /* The first half of the result is wrapped around and of no use. */
+        dsp_fft_inverse (v->fft, acc, v->work);
+        memcpy (v->output + c * block, v->work + block, sizeof (float) * block);
+
+        memcpy (in, in + block, sizeof (float) * block);
+    }
+
+    /* The tail of the next block needs none of the input still to come. */
+    if (v->tail_slices)
+    {
+        v->tail_newest = (v->newest + 1) % v->partitions;
+        dsp_workers_start (v->workers, run_tail, v, v->channels *
+         v->tail_slices);
+        v->tail_running = TRUE;
+    }
+}
+
+static void conv_process (float * * data, int * samples)
+{
+    adopt ();
+
+    Conv * v = active;
+
+    if (! v || ! v->partitions)
+        return;
+
+    int channels = v->channels;
+    int block = v->block;
+    int frames = * samples / channels;
+    float * f = * data;
+
+    while (frames)
+    {
+        int count = MIN (frames, block - v->fill);
+
+        for (int c = 0; c < channels; c ++)
+        {
+            float * in = v->input + c * 2 * block + block + v->fill;
+            float * out = v->output + c * block + v->fill;
+
+            for (int i = 0; i < count; i ++)
+            {
+                in[i] = f[channels * i + c];
+                f[channels * i + c] = out[i];
+            }
+        }
+
+        f += channels * count;
+        frames -= count;
+
+        if ((v->fill += count) == block)
+        {
+            run_block (v);
+            v->fill = 0;
+        }
+    }
+}
+
+static void conv_flush (void)
+{
+    Conv * v = active;
+
+    if (! v || ! v->partitions)
+        return;
+
+    wait_tail (v);
+
+    memset (v->history, 0, sizeof (float) * v->channels * v->partitions *
+     v->spectrum);
+    memset (v->tail_sums, 0, sizeof (float) * v->channels * MAX
+     (v->tail_slices, 1) * v->spectrum);
+    memset (v->input, 0, sizeof (float) * v->channels * 2 * v->block);
+    memset (v->output, 0, sizeof (float) * v->channels * v->block);
+    v->fill = 0;
+}
+
+static void conv_finish (float * * data, int * samples)
+{
+    adopt ();
+
+    Conv * v = active;
+
+    if (! v || ! v->partitions)
+        return;
+
+    /* Push one more block of silence through to get back the audio held up by
+     * the latency.  The rest of the reverb tail is cut off. */
+    int total = * samples + v->channels * v->block;
+
+    if (finish_samples < total)
+    {
+        finish_samples = total;
+        finish_buffer = realloc (finish_buffer, sizeof (float) * total);
+    }
+
+    memcpy (finish_buffer, * data, sizeof (float) * * samples);
+    memset (finish_buffer + * samples, 0, sizeof (float) * v->channels *
+     v->block);
+
+    * data = finish_buffer;
+    * samples = total;
+
+    conv_process (data, samples);
+    conv_flush ();
+}
+
+static int conv_adjust_delay (int delay)
+{
+    Conv * v = active;
+
+    if (! v || ! v->partitions)
+        return delay;
+
+    return delay + (int64_t) v->block * 1000 / v->rate;
+}
+
+static const char conv_about[] =
+ N_("Convolver Plugin for Audacious\n"
+    "Copyright 2013 Audacious developers\n\n"
+    "Applies an impulse response read from an audio file, for example to "
+    "correct for the acoustics of a room.  Long impulse responses are split "
+    "into partitions and convolved in the frequency domain.");
+
+AUD_EFFECT_PLUGIN
+(
+    .name = N_("Convolver"),
+    .domain = PACKAGE,
+    .about_text = conv_about,
+    .prefs = & conv_prefs,
+    .init = conv_init,
+    .cleanup = conv_cleanup,
+    .start = conv_start,
+    .process = conv_process,
+    .flush = conv_flush,
+    .finish = conv_finish,
+    .adjust_delay = conv_adjust_delay,
+    .preserves_format = TRUE
+)
@@ -25,6 +25,9 @@
 #include <audacious/plugin.h>
 #include <audacious/preferences.h>
 
+#include "dsp/dsp.h"
+#include "dsp/params.h"
+
 enum
 {
     STATE_OFF,
@@ -40,20 +43,65 @@ static const char * const crossfade_defaults[] = {
 
 static char state = STATE_OFF;
 static int current_channels = 0, current_rate = 0;
-static float * buffer = NULL;
-static int buffer_size = 0, buffer_filled = 0;
 static int prebuffer_filled = 0;
 static float * output = NULL;
 static int output_size = 0;
 
+/* The fade window is kept in a circular buffer so that audio can be handed
+ * back to the effect chain without shifting the rest of the window down on
+ * every call.  The window starts at buffer_head and continues (wrapping around
+ * at buffer_size) for buffer_filled samples.  Positions passed to the buffer
+ * functions below are relative to buffer_head. */
+static float * buffer = NULL;
+static int buffer_size = 0, buffer_head = 0, buffer_filled = 0;
+
+/* When the next song comes in a different format, the end of the previous
+ * song, which is waiting in the buffer to be faded out, is converted to the
+ * channel count and sample rate of the next song.  This way songs in different
+ * formats can still be crossfaded without running the whole stream through the
+ * Channel Mixer and Sample Rate Converter.  The length of the tail is scaled
+ * exactly, keeping the overlap the same length in time.
+ *
+ * Rather than all at once when the next song starts, the tail is converted a
+ * piece at a time, just ahead of where the next song is mixed into it.  Until
+ * then, the old tail is kept in <convert_in>.  The first <convert_done> of the
+ * <convert_frames> frames at the start of the buffer have been converted. */
+static float * convert_in = NULL;
+static int convert_in_frames = 0, convert_in_channels = 0;
+static int convert_frames = 0, convert_done = 0;
+static float convert_matrix[DSP_MAX_CHANNELS * DSP_MAX_CHANNELS];
+static float * convert_temp = NULL;
+static int convert_temp_size = 0;
+
+static DSPParamStore params;
+
+static void update_params (void)
+{
+    DSPParams p = {0};
+    p.i[0] = aud_get_int ("crossfade", "length");
+    dsp_params_publish (& params, p);
+}
+
+static void end_convert (void)
+{
+    free (convert_in);
+    convert_in = NULL;
+    free (convert_temp);
+    convert_temp = NULL;
+    convert_temp_size = 0;
+}
+
 static void reset (void)
 {
+    end_convert ();
+
     state = STATE_OFF;
     current_channels = 0;
     current_rate = 0;
     free (buffer);
     buffer = NULL;
     buffer_size = 0;
+    buffer_head = 0;
     buffer_filled = 0;
     prebuffer_filled = 0;
     free (output);
@@ -61,9 +109,76 @@ static void reset (void)
     output_size = 0;
 }
 
+/* Returns a pointer to the sample at <pos> and stores in <avail> the number of
+ * samples which can be accessed contiguously from that pointer. */
+static float * buffer_span (int pos, int * avail)
+{
+    int offset = (buffer_head + pos) % buffer_size;
+    * avail = buffer_size - offset;
+    return buffer + offset;
+}
+
+/* Makes room for at least <length> samples.  The buffer is only reallocated
+ * when the fade length or the block size grows, and is kept a whole number of
+ * frames long so that no frame is ever split across the wrap point. */
+static void enlarge_buffer (int length)
+{
+    if (length <= buffer_size)
+        return;
+
+    int frames = (length + current_channels - 1) / current_channels;
+    int new_size = frames * current_channels;
+    float * new_buffer = malloc (sizeof (float) * new_size);
+
+    if (buffer_filled)
+    {
+        int avail;
+        float * span = buffer_span (0, & avail);
+        int first = MIN (buffer_filled, avail);
+
+        memcpy (new_buffer, span, sizeof (float) * first);
+        memcpy (new_buffer + first, buffer, sizeof (float) * (buffer_filled - first));
+    }
+
+    free (buffer);
+    buffer = new_buffer;
+    buffer_size = new_size;
+    buffer_head = 0;
+}
+
+static void buffer_zero (int pos, int length)
+{
+    while (length > 0)
+    {
+        int avail;
+        float * span = buffer_span (pos, & avail);
+        int part = MIN (length, avail);
+
+        memset (span, 0, sizeof (float) * part);
+        pos += part;
+        length -= part;
+    }
+}
+
+static void buffer_write (int pos, float * data, int length)
+{
+    while (length > 0)
+    {
+        int avail;
+        float * span = buffer_span (pos, & avail);
+        int part = MIN (length, avail);
+
+        memcpy (span, data, sizeof (float) * part);
+        data += part;
+        pos += part;
+        length -= part;
+    }
+}
+
 static bool_t crossfade_init (void)
 {
     aud_config_set_defaults ("crossfade", crossfade_defaults);
+    update_params ();
     return TRUE;
 }
 
@@ -72,54 +187,148 @@ static void crossfade_cleanup (void)
     reset ();
 }
 
-static void crossfade_start (int * channels, int * rate)
+/* Sets up the conversion of the old tail to the format of the next song. */
+static void start_convert (int channels, int rate)
 {
-    if (state != STATE_BETWEEN)
-        reset ();
-    else if (* channels != current_channels)
+    int frames = buffer_filled / current_channels;
+    int new_frames = ((int64_t) frames * rate + current_rate / 2) / current_rate;
+
+    end_convert ();
+
+    if (frames)
     {
-        aud_interface_show_error (_("Crossfading failed because the songs had "
-         "a different number of channels.  You can use the Channel Mixer to "
-         "convert the songs to the same number of channels."));
-        reset ();
+        int avail;
+        float * span = buffer_span (0, & avail);
+        int first = MIN (buffer_filled, avail);
+
+        convert_in = malloc (sizeof (float) * buffer_filled);
+        memcpy (convert_in, span, sizeof (float) * first);
+        memcpy (convert_in + first, buffer, sizeof (float) * (buffer_filled - first));
+
+        convert_in_frames = frames;
+        convert_in_channels = current_channels;
+        convert_frames = new_frames;
+        convert_done = 0;
+
+        if (channels != current_channels)
+            dsp_remix_matrix (current_channels, channels, convert_matrix);
     }
-    else if (* rate != current_rate)
+
+    free (buffer);
+    buffer = NULL;
+    buffer_size = 0;
+    buffer_head = 0;
+    buffer_filled = 0;
+
+    current_channels = channels;
+    current_rate = rate;
+
+    enlarge_buffer (channels * new_frames);
+    buffer_filled = channels * new_frames;
+}
+
+/* Converts as much of the old tail as is needed for the first <length>
+ * samples of the buffer to be in the new format. */
+static void convert_until (int length)
+{
+    if (! convert_in)
+        return;
+
+    int frames = MIN ((length + current_channels - 1) / current_channels,
+     convert_frames);
+    int count = frames - convert_done;
+
+    if (count <= 0)
+        return;
+
+    int in_channels = convert_in_channels;
+    int needed = (in_channels + current_channels) * count;
+
+    if (convert_temp_size < needed)
     {
-        aud_interface_show_error (_("Crossfading failed because the songs had "
-         "different sample rates.  You can use the Sample Rate Converter to "
-         "convert the songs to the same sample rate."));
+        convert_temp = realloc (convert_temp, sizeof (float) * needed);
+        convert_temp_size = needed;
+    }
+
+    float * part = convert_temp;
+
+    dsp_resample_part (convert_in, convert_in_frames, part, convert_frames,
+     in_channels, convert_done, count);
+
+    if (in_channels != current_channels)
+    {
+        float * remixed = convert_temp + in_channels * count;
+        dsp_remix (part, in_channels, remixed, current_channels, convert_matrix,
+         count);
+        part = remixed;
+    }
+
+    buffer_write (current_channels * convert_done, part, current_channels * count);
+    convert_done = frames;
+
+    if (convert_done == convert_frames)
+        end_convert ();
+}
+
+static void crossfade_start (int * channels, int * rate)
+{
+    if (state != STATE_BETWEEN)
         reset ();
+    else if (* channels != current_channels || * rate != current_rate)
+    {
+        if (current_channels > DSP_MAX_CHANNELS || * channels > DSP_MAX_CHANNELS)
+        {
+            aud_interface_show_error (_("Crossfading failed because the songs "
+             "had too many channels to convert between them."));
+            reset ();
+        }
+        else
+            start_convert (* channels, * rate);
     }
 
     state = STATE_PREBUFFER;
     current_channels = * channels;
     current_rate = * rate;
     prebuffer_filled = 0;
+
+    /* Allocate room for the whole fade plus half a second of incoming audio up
+     * front so that the buffer does not normally need to grow while playing. */
+    int length = dsp_params_read (& params).i[0];
+    enlarge_buffer (current_channels * (current_rate * length + current_rate / 2));
 }
 
-static void do_ramp (float * data, int length, float a, float b)
+static void buffer_mix (int pos, float * data, int length)
 {
-    int count;
+    convert_until (pos + length);
 
-    for (count = 0; count < length; count ++)
+    while (length > 0)
     {
-        * data = (* data) * (a * (length - count) + b * count) / length;
-        data ++;
+        int avail;
+        float * span = buffer_span (pos, & avail);
+        int part = MIN (length, avail);
+
+        dsp_mix (span, data, part);
+        data += part;
+        pos += part;
+        length -= part;
     }
 }
 
-static void mix (float * data, float * new, int length)
+static void buffer_ramp (int pos, int length, float a, float b)
 {
-    while (length --)
-        (* data ++) += (* new ++);
-}
+    int done = 0;
 
-static void enlarge_buffer (int length)
-{
-    if (length > buffer_size)
+    convert_until (pos + length);
+
+    while (done < length)
     {
-        buffer = realloc (buffer, sizeof (float) * length);
-        buffer_size = length;
+        int avail;
+        float * span = buffer_span (pos + done, & avail);
+        int part = MIN (length - done, avail);
+
+        dsp_ramp (span, part, a + (b - a) * done / length,
+         a + (b - a) * (done + part) / length);
+        done += part;
     }
 }
 
@@ -127,7 +336,7 @@ static void add_data (float * data, int length)
 {
     if (state == STATE_PREBUFFER)
     {
-        int full = current_channels * current_rate * aud_get_int ("crossfade", "length");
+        int full = current_channels * current_rate * dsp_params_read (& params).i[0];
 
         if (prebuffer_filled < full)
         {
@@ -138,13 +347,12 @@ static void add_data (float * data, int length)
             if (prebuffer_filled + copy > buffer_filled)
             {
                 enlarge_buffer (prebuffer_filled + copy);
-                memset (buffer + buffer_filled, 0, sizeof (float) *
-                 (prebuffer_filled + copy - buffer_filled));
+                buffer_zero (buffer_filled, prebuffer_filled + copy - buffer_filled);
                 buffer_filled = prebuffer_filled + copy;
             }
 
-            do_ramp (data, copy, a, b);
-            mix (buffer + prebuffer_filled, data, copy);
+            dsp_ramp (data, copy, a, b);
+            buffer_mix (prebuffer_filled, data, copy);
             prebuffer_filled += copy;
             data += copy;
             length -= copy;
@@ -157,7 +365,7 @@ static void add_data (float * data, int length)
         {
             int copy = MIN (length, buffer_filled - prebuffer_filled);
 
-            mix (buffer + prebuffer_filled, data, copy);
+            buffer_mix (prebuffer_filled, data, copy);
             prebuffer_filled += copy;
             data += copy;
             length -= copy;
@@ -173,7 +381,7 @@ static void add_data (float * data, int length)
         return;
 
     enlarge_buffer (buffer_filled + length);
-    memcpy (buffer + buffer_filled, data, sizeof (float) * length);
+    buffer_write (buffer_filled, data, length);
     buffer_filled += length;
 }
 
@@ -186,25 +394,28 @@ static void enlarge_output (int length)
     }
 }
 
+/* Audio is returned directly out of the circular buffer.  If the available
+ * audio wraps around the end of the buffer, only the first part is returned;
+ * the rest goes out on the next call.  The returned span stays valid until
+ * then, since new audio is only ever written after the end of the window. */
 static void return_data (float * * data, int * length)
 {
-    int full = current_channels * current_rate * aud_get_int ("crossfade", "length");
+    int full = current_channels * current_rate * dsp_params_read (& params).i[0];
     int copy = buffer_filled - full;
 
-    /* only return if we have at least 1/2 second -- this reduces memmove's */
-    if (state != STATE_RUNNING || copy < current_channels * (current_rate / 2))
+    if (state != STATE_RUNNING || copy <= 0)
     {
         * data = NULL;
         * length = 0;
         return;
     }
 
-    enlarge_output (copy);
-    memcpy (output, buffer, sizeof (float) * copy);
+    int avail;
+    * data = buffer_span (0, & avail);
+    * length = copy = MIN (copy, avail);
+
+    buffer_head = (buffer_head + copy) % buffer_size;
     buffer_filled -= copy;
-    memmove (buffer, buffer + copy, sizeof (float) * buffer_filled);
-    * data = output;
-    * length = copy;
 }
 
 static void crossfade_process (float * * data, int * samples)
@@ -217,7 +428,9 @@ static void crossfade_flush (void)
 {
     if (state == STATE_PREBUFFER || state == STATE_RUNNING)
     {
+        end_convert ();
         state = STATE_RUNNING;
+        buffer_head = 0;
         buffer_filled = 0;
     }
 }
@@ -226,10 +439,16 @@ static void crossfade_finish (float * * data, int * samples)
 {
     if (state == STATE_BETWEEN) /* second call, end of last song */
     {
+        int avail = 0;
+        float * span = buffer_filled ? buffer_span (0, & avail) : NULL;
+        int first = MIN (buffer_filled, avail);
+
         enlarge_output (buffer_filled);
-        memcpy (output, buffer, sizeof (float) * buffer_filled);
+        memcpy (output, span, sizeof (float) * first);
+        memcpy (output + first, buffer, sizeof (float) * (buffer_filled - first));
         * data = output;
         * samples = buffer_filled;
+        buffer_head = 0;
         buffer_filled = 0;
         state = STATE_OFF;
         return;
@@ -240,7 +459,7 @@ static void crossfade_finish (float * * data, int * samples)
 
     if (state == STATE_PREBUFFER || state == STATE_RUNNING)
     {
-        do_ramp (buffer, buffer_filled, 1.0, 0.0);
+        buffer_ramp (0, buffer_filled, 1.0, 0.0);
         state = STATE_BETWEEN;
     }
 }
@@ -258,6 +477,7 @@ static const PreferencesWidget crossfade_widgets[] = {
  {WIDGET_LABEL, N_("<b>Crossfade</b>")},
  {WIDGET_SPIN_BTN, N_("Overlap:"),
   .cfg_type = VALUE_INT, .csect = "crossfade", .cname = "length",
+  .callback = update_params,
   .data = {.spin_btn = {1, 10, 1, N_("seconds")}}}};
 
 static const PluginPreferences crossfade_prefs = {
@@ -26,11 +26,15 @@
 #include <audacious/plugin.h>
 #include <audacious/preferences.h>
 
+#include "dsp/dsp.h"
+#include "dsp/params.h"
+
 static bool_t init (void);
 static void cryst_start (int * channels, int * rate);
 static void cryst_process (float * * data, int * samples);
 static void cryst_flush ();
 static void cryst_finish (float * * data, int * samples);
+static void update_params (void);
 
 static const char * const cryst_defaults[] = {
  "intensity", "1",
@@ -40,6 +44,7 @@ static const PreferencesWidget cryst_widgets[] = {
  {WIDGET_LABEL, N_("<b>Crystalizer</b>")},
  {WIDGET_SPIN_BTN, N_("Intensity:"),
   .cfg_type = VALUE_FLOAT, .csect = "crystalizer", .cname = "intensity",
+  .callback = update_params,
   .data = {.spin_btn = {0, 10, 0.1}}}};
 
 static const PluginPreferences cryst_prefs = {
@@ -61,10 +66,19 @@ AUD_EFFECT_PLUGIN
 
 static int cryst_channels;
 static float * cryst_prev;
+static DSPParamStore params;
+
+static void update_params (void)
+{
+    DSPParams p = {0};
+    p.f[0] = aud_get_double ("crystalizer", "intensity");
+    dsp_params_publish (& params, p);
+}
 
 static bool_t init (void)
 {
     aud_config_set_defaults ("crystalizer", cryst_defaults);
+    update_params ();
     return TRUE;
 }
 
@@ -77,11 +91,17 @@ static void cryst_start (int * channels, int * rate)
 
 static void cryst_process (float * * data, int * samples)
 {
-    float value = aud_get_double ("crystalizer", "intensity");
+    float value = dsp_params_read (& params).f[0];
     float * f = * data;
     float * end = f + (* samples);
     int channel;
 
+    if (cryst_channels == 2)
+    {
+        dsp_stereo (f, (* samples) / 2, cryst_prev, value, 1, 1);
+        return;
+    }
+
     while (f < end)
     {
         for (channel = 0; channel < cryst_channels; channel ++)
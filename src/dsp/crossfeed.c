@@ -0,0 +1,58 @@
+/*
+ * Bauer Stereophonic-to-Binaural Crossfeed Filter
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "dsp.h"
+
+/* This is the design used by libbs2b.  The feed level sets the gains of the
+ * two filters, and the high shelf is placed so that together they give a flat
+ * response for centred sounds.  Both are first order, with the pole at
+ * exp (-w); 1 - exp (-w) is taken from expm1() so that the zero frequency gain
+ * stays exact at high sample rates, where w is tiny. */
+
+void dsp_crossfeed_set (DSPCrossfeed * cf, int rate, int feed, int fcut)
+{
+    double level = feed / 10.0;
+    double gb_lo = level * -5 / 6 - 3;
+    double gb_hi = level / 6 - 3;
+    double g_lo = pow (10, gb_lo / 20);
+    double g_hi = 1 - pow (10, gb_hi / 20);
+    double fc_hi = fcut * pow (2, (gb_lo - 20 * log10 (g_hi)) / 12);
+    double w;
+
+    w = 2 * M_PI * fcut / rate;
+    cf->lo_b1 = exp (-w);
+    cf->lo_a0 = g_lo * -expm1 (-w);
+
+    w = 2 * M_PI * fc_hi / rate;
+    cf->hi_b1 = exp (-w);
+    cf->hi_a0 = 1 - g_hi * -expm1 (-w);
+    cf->hi_a1 = -cf->hi_b1;
+
+    cf->gain = 1 / (1 - g_hi + g_lo);
+}
+
+void dsp_crossfeed_clear (DSPCrossfeed * cf)
+{
+    memset (cf->lo, 0, sizeof cf->lo);
+    memset (cf->hi, 0, sizeof cf->hi);
+    memset (cf->last, 0, sizeof cf->last);
+}
@@ -0,0 +1,176 @@
+/*
+ * Shared DSP Kernels for Audacious Effect Plugins
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef AUD_DSP_H
+#define AUD_DSP_H
+
+/* crossfeed.c */
+
+/* A Bauer stereophonic-to-binaural crossfeed filter: a low-pass filter on the
+ * signal fed to the opposite channel and a high shelf on the direct signal.
+ * Index 0 of each pair of filter states is for the left channel. */
+typedef struct {
+    double lo_a0, lo_b1;
+    double hi_a0, hi_a1, hi_b1;
+    double gain;
+    double lo[2], hi[2], last[2];
+} DSPCrossfeed;
+
+/* Computes the filter coefficients for a sample rate, a feed level in tenths
+ * of a decibel, and a cut frequency in Hz.  The filter states are not touched,
+ * so this can be called while playing without a click. */
+void dsp_crossfeed_set (DSPCrossfeed * cf, int rate, int feed, int fcut);
+
+/* Resets the filter states. */
+void dsp_crossfeed_clear (DSPCrossfeed * cf);
+
+/* These are the inner loops shared by several effect plugins.  Each has a plain
+ * C version as well as SSE2, AVX2, and NEON versions; the fastest one supported
+ * by the CPU is picked the first time any of them is called. */
+
+/* Multiplies <length> samples by a gain which changes linearly from <a> at the
+ * first sample toward <b>, which it would reach at sample <length>. */
+void dsp_ramp (float * data, int length, float a, float b);
+
+/* Adds <length> samples from <add> to those in <data>. */
+void dsp_mix (float * data, const float * add, int length);
+
+/* Returns the sum of the absolute values of <length> samples. */
+float dsp_abs_sum (const float * data, int length);
+
+/* Adds <length> samples from <add>, each multiplied by the matching gain in
+ * <gain>, to those in <data>. */
+void dsp_mix_mul (float * data, const float * add, const float * gain, int length);
+
+/* Returns the sum of the products of <length> pairs of samples. */
+float dsp_dot (const float * a, const float * b, int length);
+
+/* Processes <frames> frames of stereo audio in a single pass, doing the work of
+ * the Crystalizer, Extra Stereo, and Voice Removal effects together.  First
+ * each sample has its difference from the one before multiplied by <sharpen>
+ * and added back in; <prev> holds the previous left and right input samples and
+ * is updated.  Then the result is split into mid and side signals, which are
+ * multiplied by <mid> and <side> and put back together. */
+void dsp_stereo (float * data, int frames, float * prev, float sharpen, float
+ mid, float side);
+
+/* Runs <frames> frames of stereo audio through a crossfeed filter set up by
+ * dsp_crossfeed_set().  The filter works in double precision and clips its
+ * output to -1 ... 1. */
+void dsp_crossfeed (DSPCrossfeed * cf, float * data, int frames);
+
+/* Multiplies two spectra of <bins> complex values and adds the result to <acc>.
+ * Each spectrum is stored as <bins> real parts followed by <bins> imaginary
+ * parts, as dsp_fft_forward() gives them. */
+void dsp_spectrum_mac (float * acc, const float * a, const float * b, int bins);
+
+/* Interleaves <frames> frames of planar audio, one plane of samples of
+ * <sample_size> bytes for each of <channels> channels, into <out>.  Samples
+ * are only copied, so this works for any format.  Only 16- and 32-bit stereo
+ * has SIMD versions. */
+void dsp_interleave (const void * const * planes, int sample_size, int
+ channels, void * out, int frames);
+
+/* fft.c */
+
+typedef struct DSPFFT DSPFFT;
+
+/* <size> must be a power of two, at least 4.  A DSPFFT has working space of
+ * its own, so it must not be used by two threads at once. */
+DSPFFT * dsp_fft_new (int size);
+void dsp_fft_free (DSPFFT * fft);
+
+/* Transforms <size> real samples into <size> / 2 + 1 complex values, which
+ * take up <size> + 2 floats: all the real parts and then all the imaginary
+ * parts. */
+void dsp_fft_forward (DSPFFT * fft, const float * in, float * out);
+
+/* The inverse of dsp_fft_forward(), including the scaling, so that the two
+ * together give back the original samples. */
+void dsp_fft_inverse (DSPFFT * fft, const float * in, float * out);
+
+/* remix.c */
+
+#define DSP_MAX_CHANNELS 8
+
+/* Fills <matrix> with the coefficients for converting audio from one channel
+ * layout to another.  The layouts are the usual ones for 1 to DSP_MAX_CHANNELS
+ * channels (mono, stereo, 3.0, quad, 5.0, 5.1, 6.1, 7.1).  The matrix has one
+ * row of <in_channels> coefficients for each output channel. */
+void dsp_remix_matrix (int in_channels, int out_channels, float * matrix);
+
+/* Converts <frames> frames of audio using a matrix from dsp_remix_matrix().
+ * This one is in kernels.c and has SIMD versions like the functions above. */
+void dsp_remix (const float * in, int in_channels, float * out, int
+ out_channels, const float * matrix, int frames);
+
+/* resample.c */
+
+/* Resamples a complete, self-contained block of audio so that <in_frames>
+ * frames become exactly <out_frames> frames.  This uses a windowed sinc filter
+ * and is meant for one-off conversions, not for continuous streams. */
+void dsp_resample (const float * in, int in_frames, float * out, int
+ out_frames, int channels);
+
+/* Computes only frames <first_out> to <first_out> + <count> - 1 of what
+ * dsp_resample() would give, and writes them to the start of <out>.  Each frame
+ * depends only on the input, so a block converted a piece at a time comes out
+ * the same as one converted all at once. */
+void dsp_resample_part (const float * in, int in_frames, float * out, int
+ out_frames, int channels, int first_out, int count);
+
+/* True peaks are found by 4x oversampling, as in BS.1770: the highest of a
+ * sample and the points 1/4, 2/4, and 3/4 of the way to the next one. */
+#define DSP_TP_PHASES 4 /* oversampling factor */
+#define DSP_TP_TAPS 12 /* per phase */
+#define DSP_TP_HALF (DSP_TP_TAPS / 2)
+
+/* Fills <filter> with (DSP_TP_PHASES - 1) * DSP_TP_TAPS coefficients:
+ * windowed sinc filters for the points between samples. */
+void dsp_true_peak_filter (float * filter);
+
+/* Returns the true peak at sample DSP_TP_HALF - 1 of the DSP_TP_TAPS samples
+ * in <taps>, using a filter from dsp_true_peak_filter(). */
+float dsp_true_peak (const float * taps, const float * filter);
+
+/* workers.c */
+
+/* A small pool of threads which stay alive between blocks, so that work on
+ * each block can be split up without the cost of starting new threads. */
+typedef struct DSPWorkers DSPWorkers;
+
+/* <threads> counts the calling thread, so 1 means no extra threads at all. */
+DSPWorkers * dsp_workers_new (int threads);
+void dsp_workers_free (DSPWorkers * workers);
+
+/* Calls <func> once for each <index> from 0 to <count> - 1, spread across the
+ * pool and the calling thread, and returns once all the calls have finished.
+ * The calls must not depend on each other. */
+void dsp_workers_run (DSPWorkers * workers, void (* func) (void * data, int
+ index), void * data, int count);
+
+/* Like dsp_workers_run(), but leaves the calls to the pool and returns at once,
+ * so that the calling thread can get on with something else.  If the pool has
+ * no threads, the calls are made before returning.  dsp_workers_wait() must be
+ * called before the next job is started or the data is touched. */
+void dsp_workers_start (DSPWorkers * workers, void (* func) (void * data, int
+ index), void * data, int count);
+void dsp_workers_wait (DSPWorkers * workers);
+
+#endif
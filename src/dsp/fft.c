@@ -0,0 +1,195 @@
+/*
+ * Real FFT for Audacious Effect Plugins
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "dsp.h"
+
+/* A real transform of <size> points is done as a complex transform of size / 2
+ * points, with the even samples as the real parts and the odd samples as the
+ * imaginary parts, followed by a step which separates the two.  The complex
+ * transform is an iterative radix-2 one with tabulated twiddle factors. */
+
+struct DSPFFT {
+    int size, half;
+    int * reverse; /* bit reversal permutation, <half> entries */
+    float * twiddle; /* exp (-2 pi i k / half), interleaved, <half> / 2 entries */
+    float * split; /* exp (-2 pi i k / size), interleaved, <half> + 1 entries */
+    float * work; /* <half> complex values, interleaved */
+};
+
+DSPFFT * dsp_fft_new (int size)
+{
+    if (size < 4 || (size & (size - 1)))
+        return NULL;
+
+    DSPFFT * fft = malloc (sizeof (DSPFFT));
+    int half = size / 2;
+
+    fft->size = size;
+    fft->half = half;
+    fft->reverse = malloc (sizeof (int) * half);
+    fft->twiddle = malloc (sizeof (float) * half);
+    fft->split = malloc (sizeof (float) * 2 * (half + 1));
+    fft->work = malloc (sizeof (float) * 2 * half);
+
+    int bits = 0;
+    while ((1 << bits) < half)
+        bits ++;
+
+    for (int i = 0; i < half; i ++)
+    {
+        int r = 0;
+
+        for (int b = 0; b < bits; b ++)
+        {
+            if (i & (1 << b))
+                r |= 1 << (bits - 1 - b);
+        }
+
+        fft->reverse[i] = r;
+    }
+
+    for (int k = 0; k < half / 2; k ++)
+    {
+        fft->twiddle[2 * k] = cos (2 * M_PI * k / half);
+        fft->twiddle[2 * k + 1] = -sin (2 * M_PI * k / half);
+    }
+
+    for (int k = 0; k <= half; k ++)
+    {
+        fft->split[2 * k] = cos (2 * M_PI * k / size);
+        fft->split[2 * k + 1] = -sin (2 * M_PI * k / size);
+    }
+
+    return fft;
+}
+
+void dsp_fft_free (DSPFFT * fft)
+{
+    free (fft->reverse);
+    free (fft->twiddle);
+    free (fft->split);
+    free (fft->work);
+    free (fft);
+}
+
+/* Transforms fft->work in place, which must already be in bit reversed order.
+ * The inverse transform is not scaled. */
+static void transform (DSPFFT * fft, int inverse)
+{
+    float * w = fft->work;
+    int half = fft->half;
+    float sign = inverse ? -1 : 1;
+
+    for (int len = 2; len <= half; len *= 2)
+    {
+        int step = half / len;
+
+        for (int start = 0; start < half; start += len)
+        {
+            for (int k = 0; k < len / 2; k ++)
+            {
+                float tr = fft->twiddle[2 * k * step];
+                float ti = fft->twiddle[2 * k * step + 1] * sign;
+                float * a = w + 2 * (start + k);
+                float * b = w + 2 * (start + k + len / 2);
+                float br = b[0] * tr - b[1] * ti;
+                float bi = b[0] * ti + b[1] * tr;
+
+                b[0] = a[0] - br;
+                b[1] = a[1] - bi;
+                a[0] += br;
+                a[1] += bi;
+            }
+        }
+    }
+}
+
+void dsp_fft_forward (DSPFFT * fft, const float * in, float * out)
+{
+    int half = fft->half;
+    float * w = fft->work;
+    float * re = out, * im = out + half + 1;
+
+    for (int i = 0; i < half; i ++)
+    {
+        int r = fft->reverse[i];
+        w[2 * r] = in[2 * i];
+        w[2 * r + 1] = in[2 * i + 1];
+    }
+
+    transform (fft, 0);
+
+    /* X[k] = e + W^k * o, where e = (Z[k] + conj (Z[half - k])) / 2 and
+     * o = -i * (Z[k] - conj (Z[half - k])) / 2 */
+    for (int k = 0; k <= half; k ++)
+    {
+        int a = (k == half) ? 0 : k;
+        int b = (k == 0) ? 0 : half - k;
+        float zr = w[2 * a], zi = w[2 * a + 1];
+        float cr = w[2 * b], ci = -w[2 * b + 1];
+        float er = (zr + cr) / 2, ei = (zi + ci) / 2;
+        float dr = (zr - cr) / 2, di = (zi - ci) / 2;
+        float sr = fft->split[2 * k], si = fft->split[2 * k + 1];
+
+        /* p = W^k * d; W^k * o = -i * p */
+        float pr = sr * dr - si * di;
+        float pi = sr * di + si * dr;
+
+        re[k] = er + pi;
+        im[k] = ei - pr;
+    }
+}
+
+void dsp_fft_inverse (DSPFFT * fft, const float * in, float * out)
+{
+    int half = fft->half;
+    float * w = fft->work;
+    const float * re = in, * im = in + half + 1;
+    float scale = 1.0f / half;
+
+    /* Z[k] = e + i * o, where e = (X[k] + conj (X[half - k])) / 2 and
+     * o = conj (W^k) * (X[k] - conj (X[half - k])) / 2 */
+    for (int k = 0; k < half; k ++)
+    {
+        float xr = re[k], xi = im[k];
+        float cr = re[half - k], ci = -im[half - k];
+        float er = xr + cr, ei = xi + ci;
+        float dr = xr - cr, di = xi - ci;
+        float sr = fft->split[2 * k], si = -fft->split[2 * k + 1];
+
+        /* p = conj (W^k) * d; i * o = i * p / 2 */
+        float pr = sr * dr - si * di;
+        float pi = sr * di + si * dr;
+
+        int r = fft->reverse[k];
+        w[2 * r] = (er - pi) / 2;
+        w[2 * r + 1] = (ei + pr) / 2;
+    }
+
+    transform (fft, 1);
+
+    for (int i = 0; i < half; i ++)
+    {
+        out[2 * i] = w[2 * i] * scale;
+        out[2 * i + 1] = w[2 * i + 1] * scale;
+    }
+}
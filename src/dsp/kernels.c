@@ -0,0 +1,1148 @@
+/*
+ * Shared DSP Kernels for Audacious Effect Plugins
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dsp.h"
+
+#if defined (__GNUC__) && (defined (__i386__) || defined (__x86_64__))
+#define DSP_X86
+#define TARGET(t) __attribute__ ((target (t)))
+#include <immintrin.h>
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+#define DSP_NEON
+#include <arm_neon.h>
+#endif
+
+typedef struct {
+    void (* ramp) (float * data, int length, float a, float b);
+    void (* mix) (float * data, const float * add, int length);
+    float (* abs_sum) (const float * data, int length);
+    void (* mix_mul) (float * data, const float * add, const float * gain, int length);
+    float (* dot) (const float * a, const float * b, int length);
+    void (* remix) (const float * in, int in_channels, float * out, int
+     out_channels, const float * matrix, int frames);
+    void (* stereo) (float * data, int frames, float * prev, float sharpen,
+     float mid, float side);
+    void (* crossfeed) (DSPCrossfeed * cf, float * data, int frames);
+    void (* spectrum_mac) (float * acc, const float * a, const float * b, int bins);
+    void (* interleave_stereo_16) (const int16_t * left, const int16_t * right,
+     int16_t * out, int frames);
+    void (* interleave_stereo_32) (const int32_t * left, const int32_t * right,
+     int32_t * out, int frames);
+} DSPKernels;
+
+/* The gain for sample i is computed directly as a + step * i rather than by
+ * adding step repeatedly, so that every version gives exactly the same result
+ * and there is no drift over long ramps. */
+
+static void ramp_c (float * data, int length, float a, float b)
+{
+    float step = (b - a) / length;
+
+    for (int i = 0; i < length; i ++)
+        data[i] *= a + step * i;
+}
+
+static void mix_c (float * data, const float * add, int length)
+{
+    for (int i = 0; i < length; i ++)
+        data[i] += add[i];
+}
+
+static float abs_sum_c (const float * data, int length)
+{
+    float sum = 0;
+
+    for (int i = 0; i < length; i ++)
+        sum += fabsf (data[i]);
+
+    return sum;
+}
+
+static void mix_mul_c (float * data, const float * add, const float * gain, int length)
+{
+    for (int i = 0; i < length; i ++)
+        data[i] += add[i] * gain[i];
+}
+
+static float dot_c (const float * a, const float * b, int length)
+{
+    float sum = 0;
+
+    for (int i = 0; i < length; i ++)
+        sum += a[i] * b[i];
+
+    return sum;
+}
+
+static void remix_c (const float * in, int in_channels, float * out, int
+ out_channels, const float * matrix, int frames)
+{
+    while (frames --)
+    {
+        const float * coef = matrix;
+
+        for (int o = 0; o < out_channels; o ++)
+        {
+            float sum = 0;
+
+            for (int i = 0; i < in_channels; i ++)
+                sum += in[i] * (* coef ++);
+
+            out[o] = sum;
+        }
+
+        in += in_channels;
+        out += out_channels;
+    }
+}
+
+/* The SIMD versions of remix work one frame at a time, with the coefficients
+ * for each input channel held in a vector across the output channels.  Each
+ * frame is stored at full vector width, spilling into the next frame, which is
+ * then written over; the last few frames, where that would go past the end of
+ * the output, are done by remix_c.  Every output is summed in the same order as
+ * in remix_c, so the results are exactly the same. */
+
+static void remix_columns (int in_channels, int out_channels, const float *
+ matrix, float columns[DSP_MAX_CHANNELS][8])
+{
+    for (int i = 0; i < in_channels; i ++)
+    {
+        for (int o = 0; o < 8; o ++)
+            columns[i][o] = (o < out_channels) ? matrix[in_channels * o + i] : 0;
+    }
+}
+
+/* In the SIMD versions of stereo, each lane of a vector works on the same
+ * channel as in stereo_c, and for the right channel the side signal comes out
+ * negated, which is exact.  The sums are in the same order, so again the
+ * results are exactly the same. */
+
+static void stereo_c (float * data, int frames, float * prev, float sharpen,
+ float mid, float side)
+{
+    while (frames --)
+    {
+        float l = data[0] + (data[0] - prev[0]) * sharpen;
+        float r = data[1] + (data[1] - prev[1]) * sharpen;
+
+        prev[0] = data[0];
+        prev[1] = data[1];
+
+        float m = (l + r) * 0.5f;
+        float s = (l - r) * 0.5f;
+
+        data[0] = m * mid + s * side;
+        data[1] = m * mid - s * side;
+
+        data += 2;
+    }
+}
+
+static void crossfeed_c (DSPCrossfeed * cf, float * data, int frames)
+{
+    while (frames --)
+    {
+        double l = data[0];
+        double r = data[1];
+
+        cf->lo[0] = cf->lo_a0 * l + cf->lo_b1 * cf->lo[0];
+        cf->lo[1] = cf->lo_a0 * r + cf->lo_b1 * cf->lo[1];
+        cf->hi[0] = cf->hi_a0 * l + cf->hi_a1 * cf->last[0] + cf->hi_b1 * cf->hi[0];
+        cf->hi[1] = cf->hi_a0 * r + cf->hi_a1 * cf->last[1] + cf->hi_b1 * cf->hi[1];
+        cf->last[0] = l;
+        cf->last[1] = r;
+
+        l = (cf->hi[0] + cf->lo[1]) * cf->gain;
+        r = (cf->hi[1] + cf->lo[0]) * cf->gain;
+
+        data[0] = (l < -1) ? -1 : (l > 1) ? 1 : l;
+        data[1] = (r < -1) ? -1 : (r > 1) ? 1 : r;
+
+        data += 2;
+    }
+}
+
+static void spectrum_mac_c (float * acc, const float * a, const float * b, int bins)
+{
+    float * acc_im = acc + bins;
+    const float * a_im = a + bins, * b_im = b + bins;
+
+    for (int i = 0; i < bins; i ++)
+    {
+        acc[i] += a[i] * b[i] - a_im[i] * b_im[i];
+        acc_im[i] += a[i] * b_im[i] + a_im[i] * b[i];
+    }
+}
+
+/* Interleaving only moves bits around, so floats are handled as 32-bit
+ * integers.  Only 16- and 32-bit stereo has SIMD versions, being by far the
+ * most common case; everything else goes through interleave_c. */
+
+static void interleave_stereo_16_c (const int16_t * left, const int16_t * right,
+ int16_t * out, int frames)
+{
+    for (int i = 0; i < frames; i ++)
+    {
+        out[2 * i] = left[i];
+        out[2 * i + 1] = right[i];
+    }
+}
+
+static void interleave_stereo_32_c (const int32_t * left, const int32_t * right,
+ int32_t * out, int frames)
+{
+    for (int i = 0; i < frames; i ++)
+    {
+        out[2 * i] = left[i];
+        out[2 * i + 1] = right[i];
+    }
+}
+
+static void interleave_c (const void * const * planes, int sample_size, int
+ channels, void * out, int frames)
+{
+    for (int c = 0; c < channels; c ++)
+    {
+        const char * in = planes[c];
+        char * set = (char *) out + sample_size * c;
+
+        switch (sample_size)
+        {
+        case 1:
+            for (int i = 0; i < frames; i ++)
+                set[channels * i] = in[i];
+            break;
+        case 2:
+            for (int i = 0; i < frames; i ++)
+                ((int16_t *) set)[channels * i] = ((const int16_t *) in)[i];
+            break;
+        case 4:
+            for (int i = 0; i < frames; i ++)
+                ((int32_t *) set)[channels * i] = ((const int32_t *) in)[i];
+            break;
+        default:
+            for (int i = 0; i < frames; i ++)
+                memcpy (set + sample_size * channels * i, in + sample_size * i,
+                 sample_size);
+            break;
+        }
+    }
+}
+
+static const DSPKernels kernels_c = {ramp_c, mix_c, abs_sum_c, mix_mul_c, dot_c,
+ remix_c, stereo_c, crossfeed_c, spectrum_mac_c, interleave_stereo_16_c,
+ interleave_stereo_32_c};
+
+#ifdef DSP_X86
+
+TARGET ("sse2") static void ramp_sse2 (float * data, int length, float a, float b)
+{
+    float step = (b - a) / length;
+    __m128 va = _mm_set1_ps (a);
+    __m128 vstep = _mm_set1_ps (step);
+    __m128 index = _mm_setr_ps (0, 1, 2, 3);
+    __m128 four = _mm_set1_ps (4);
+    int i = 0;
+
+    for (; i + 4 <= length; i += 4)
+    {
+        __m128 gain = _mm_add_ps (va, _mm_mul_ps (vstep, index));
+        _mm_storeu_ps (data + i, _mm_mul_ps (_mm_loadu_ps (data + i), gain));
+        index = _mm_add_ps (index, four);
+    }
+
+    for (; i < length; i ++)
+        data[i] *= a + step * i;
+}
+
+TARGET ("sse2") static void mix_sse2 (float * data, const float * add, int length)
+{
+    int i = 0;
+
+    for (; i + 4 <= length; i += 4)
+        _mm_storeu_ps (data + i, _mm_add_ps (_mm_loadu_ps (data + i),
+         _mm_loadu_ps (add + i)));
+
+    for (; i < length; i ++)
+        data[i] += add[i];
+}
+
+TARGET ("sse2") static float abs_sum_sse2 (const float * data, int length)
+{
+    __m128 mask = _mm_castsi128_ps (_mm_set1_epi32 (0x7fffffff));
+    __m128 sum0 = _mm_setzero_ps ();
+    __m128 sum1 = _mm_setzero_ps ();
+    int i = 0;
+
+    for (; i + 8 <= length; i += 8)
+    {
+        sum0 = _mm_add_ps (sum0, _mm_and_ps (_mm_loadu_ps (data + i), mask));
+        sum1 = _mm_add_ps (sum1, _mm_and_ps (_mm_loadu_ps (data + i + 4), mask));
+    }
+
+    float part[4];
+    _mm_storeu_ps (part, _mm_add_ps (sum0, sum1));
+    float sum = (part[0] + part[1]) + (part[2] + part[3]);
+
+    for (; i < length; i ++)
+        sum += fabsf (data[i]);
+
+    return sum;
+}
+
+TARGET ("avx2") static void ramp_avx2 (float * data, int length, float a, float b)
+{
+    float step = (b - a) / length;
+    __m256 va = _mm256_set1_ps (a);
+    __m256 vstep = _mm256_set1_ps (step);
+    __m256 index = _mm256_setr_ps (0, 1, 2, 3, 4, 5, 6, 7);
+    __m256 eight = _mm256_set1_ps (8);
+    int i = 0;
+
+    for (; i + 8 <= length; i += 8)
+    {
+        __m256 gain = _mm256_add_ps (va, _mm256_mul_ps (vstep, index));
+        _mm256_storeu_ps (data + i, _mm256_mul_ps (_mm256_loadu_ps (data + i), gain));
+        index = _mm256_add_ps (index, eight);
+    }
+
+    for (; i < length; i ++)
+        data[i] *= a + step * i;
+}
+
+TARGET ("avx2") static void mix_avx2 (float * data, const float * add, int length)
+{
+    int i = 0;
+
+    for (; i + 8 <= length; i += 8)
+        _mm256_storeu_ps (data + i, _mm256_add_ps (_mm256_loadu_ps (data + i),
+         _mm256_loadu_ps (add + i)));
+
+    for (; i < length; i ++)
+        data[i] += add[i];
+}
+
+TARGET ("avx2") static float abs_sum_avx2 (const float * data, int length)
+{
+    __m256 mask = _mm256_castsi256_ps (_mm256_set1_epi32 (0x7fffffff));
+    __m256 sum0 = _mm256_setzero_ps ();
+    __m256 sum1 = _mm256_setzero_ps ();
+    int i = 0;
+
+    for (; i + 16 <= length; i += 16)
+    {
+        sum0 = _mm256_add_ps (sum0, _mm256_and_ps (_mm256_loadu_ps (data + i), mask));
+        sum1 = _mm256_add_ps (sum1, _mm256_and_ps (_mm256_loadu_ps (data + i + 8), mask));
+    }
+
+    float part[8];
+    _mm256_storeu_ps (part, _mm256_add_ps (sum0, sum1));
+    float sum = ((part[0] + part[1]) + (part[2] + part[3])) +
+     ((part[4] + part[5]) + (part[6] + part[7]));
+
+    for (; i < length; i ++)
+        sum += fabsf (data[i]);
+
+    return sum;
+}
+
+TARGET ("sse2") static void mix_mul_sse2 (float * data, const float * add, const float * gain, int length)
+{
+    int i = 0;
+
+    for (; i + 4 <= length; i += 4)
+        _mm_storeu_ps (data + i, _mm_add_ps (_mm_loadu_ps (data + i),
+         _mm_mul_ps (_mm_loadu_ps (add + i), _mm_loadu_ps (gain + i))));
+
+    for (; i < length; i ++)
+        data[i] += add[i] * gain[i];
+}
+
+TARGET ("sse2") static float dot_sse2 (const float * a, const float * b, int length)
+{
+    __m128 sum0 = _mm_setzero_ps ();
+    __m128 sum1 = _mm_setzero_ps ();
+    int i = 0;
+
+    for (; i + 8 <= length; i += 8)
+    {
+        sum0 = _mm_add_ps (sum0, _mm_mul_ps (_mm_loadu_ps (a + i), _mm_loadu_ps (b + i)));
+        sum1 = _mm_add_ps (sum1, _mm_mul_ps (_mm_loadu_ps (a + i + 4), _mm_loadu_ps (b + i + 4)));
+    }
+
+    float part[4];
+    _mm_storeu_ps (part, _mm_add_ps (sum0, sum1));
+    float sum = (part[0] + part[1]) + (part[2] + part[3]);
+
+    for (; i < length; i ++)
+        sum += a[i] * b[i];
+
+    return sum;
+}
+
+TARGET ("avx2") static void mix_mul_avx2 (float * data, const float * add, const float * gain, int length)
+{
+    int i = 0;
+
+    for (; i + 8 <= length; i += 8)
+        _mm256_storeu_ps (data + i, _mm256_add_ps (_mm256_loadu_ps (data + i),
+         _mm256_mul_ps (_mm256_loadu_ps (add + i), _mm256_loadu_ps (gain + i))));
+
+    for (; i < length; i ++)
+        data[i] += add[i] * gain[i];
+}
+
+TARGET ("avx2") static float dot_avx2 (const float * a, const float * b, int length)
+{
+    __m256 sum0 = _mm256_setzero_ps ();
+    __m256 sum1 = _mm256_setzero_ps ();
+    int i = 0;
+
+    for (; i + 16 <= length; i += 16)
+    {
+        sum0 = _mm256_add_ps (sum0, _mm256_mul_ps (_mm256_loadu_ps (a + i), _mm256_loadu_ps (b + i)));
+        sum1 = _mm256_add_ps (sum1, _mm256_mul_ps (_mm256_loadu_ps (a + i + 8), _mm256_loadu_ps (b + i + 8)));
+    }
+
+    float part[8];
+    _mm256_storeu_ps (part, _mm256_add_ps (sum0, sum1));
+    float sum = ((part[0] + part[1]) + (part[2] + part[3])) +
+     ((part[4] + part[5]) + (part[6] + part[7]));
+
+    for (; i < length; i ++)
+        sum += a[i] * b[i];
+
+    return sum;
+}
+
+TARGET ("sse2") static void remix_sse2 (const float * in, int in_channels, float
+ * out, int out_channels, const float * matrix, int frames)
+{
+    float columns[DSP_MAX_CHANNELS][8];
+    __m128 lo[DSP_MAX_CHANNELS], hi[DSP_MAX_CHANNELS];
+
+    remix_columns (in_channels, out_channels, matrix, columns);
+
+    for (int i = 0; i < in_channels; i ++)
+    {
+        lo[i] = _mm_loadu_ps (columns[i]);
+        hi[i] = _mm_loadu_ps (columns[i] + 4);
+    }
+
+    int width = (out_channels > 4) ? 8 : 4;
+
+    for (; frames * out_channels >= width + out_channels; frames --)
+    {
+        __m128 a = _mm_setzero_ps ();
+        __m128 b = _mm_setzero_ps ();
+
+        for (int i = 0; i < in_channels; i ++)
+        {
+            __m128 v = _mm_set1_ps (in[i]);
+            a = _mm_add_ps (a, _mm_mul_ps (v, lo[i]));
+            b = _mm_add_ps (b, _mm_mul_ps (v, hi[i]));
+        }
+
+        _mm_storeu_ps (out, a);
+        if (width == 8)
+            _mm_storeu_ps (out + 4, b);
+
+        in += in_channels;
+        out += out_channels;
+    }
+
+    remix_c (in, in_channels, out, out_channels, matrix, frames);
+}
+
+TARGET ("avx2") static void remix_avx2 (const float * in, int in_channels, float
+ * out, int out_channels, const float * matrix, int frames)
+{
+    float columns[DSP_MAX_CHANNELS][8];
+    __m256 col[DSP_MAX_CHANNELS];
+
+    remix_columns (in_channels, out_channels, matrix, columns);
+
+    for (int i = 0; i < in_channels; i ++)
+        col[i] = _mm256_loadu_ps (columns[i]);
+
+    for (; frames * out_channels >= 8 + out_channels; frames --)
+    {
+        __m256 a = _mm256_setzero_ps ();
+
+        for (int i = 0; i < in_channels; i ++)
+            a = _mm256_add_ps (a, _mm256_mul_ps (_mm256_set1_ps (in[i]), col[i]));
+
+        _mm256_storeu_ps (out, a);
+
+        in += in_channels;
+        out += out_channels;
+    }
+
+    remix_c (in, in_channels, out, out_channels, matrix, frames);
+}
+
+/* Two frames per vector; the previous input frame of each is taken from the
+ * top half of the last vector loaded and the bottom half of this one. */
+
+TARGET ("sse2") static void stereo_sse2 (float * data, int frames, float *
+ prev, float sharpen, float mid, float side)
+{
+    __m128 last = _mm_set_ps (prev[1], prev[0], 0, 0);
+    __m128 vsharpen = _mm_set1_ps (sharpen);
+    __m128 vmid = _mm_set1_ps (mid);
+    __m128 vside = _mm_set1_ps (side);
+    __m128 half = _mm_set1_ps (0.5f);
+    float saved[4];
+
+    for (; frames >= 2; frames -= 2)
+    {
+        __m128 v = _mm_loadu_ps (data);
+        __m128 p = _mm_shuffle_ps (last, v, _MM_SHUFFLE (1, 0, 3, 2));
+        __m128 x = _mm_add_ps (v, _mm_mul_ps (_mm_sub_ps (v, p), vsharpen));
+        __m128 swap = _mm_shuffle_ps (x, x, _MM_SHUFFLE (2, 3, 0, 1));
+        __m128 m = _mm_mul_ps (_mm_add_ps (x, swap), half);
+        __m128 s = _mm_mul_ps (_mm_sub_ps (x, swap), half);
+
+        _mm_storeu_ps (data, _mm_add_ps (_mm_mul_ps (m, vmid), _mm_mul_ps (s, vside)));
+
+        last = v;
+        data += 4;
+    }
+
+    _mm_storeu_ps (saved, last);
+    prev[0] = saved[2];
+    prev[1] = saved[3];
+
+    stereo_c (data, frames, prev, sharpen, mid, side);
+}
+
+TARGET ("avx2") static void stereo_avx2 (float * data, int frames, float *
+ prev, float sharpen, float mid, float side)
+{
+    __m256 last = _mm256_set_ps (prev[1], prev[0], 0, 0, 0, 0, 0, 0);
+    __m256 vsharpen = _mm256_set1_ps (sharpen);
+    __m256 vmid = _mm256_set1_ps (mid);
+    __m256 vside = _mm256_set1_ps (side);
+    __m256 half = _mm256_set1_ps (0.5f);
+    float saved[8];
+
+    for (; frames >= 4; frames -= 4)
+    {
+        __m256 v = _mm256_loadu_ps (data);
+        __m256 t = _mm256_permute2f128_ps (last, v, 0x21);
+        __m256 p = _mm256_shuffle_ps (t, v, _MM_SHUFFLE (1, 0, 3, 2));
+        __m256 x = _mm256_add_ps (v, _mm256_mul_ps (_mm256_sub_ps (v, p), vsharpen));
+        __m256 swap = _mm256_permute_ps (x, _MM_SHUFFLE (2, 3, 0, 1));
+        __m256 m = _mm256_mul_ps (_mm256_add_ps (x, swap), half);
+        __m256 s = _mm256_mul_ps (_mm256_sub_ps (x, swap), half);
+
+        _mm256_storeu_ps (data, _mm256_add_ps (_mm256_mul_ps (m, vmid),
+         _mm256_mul_ps (s, vside)));
+
+        last = v;
+        data += 8;
+    }
+
+    _mm256_storeu_ps (saved, last);
+    prev[0] = saved[6];
+    prev[1] = saved[7];
+
+    stereo_c (data, frames, prev, sharpen, mid, side);
+}
+
+/* Each frame depends on the one before, so the crossfeed filter cannot be
+ * spread across frames.  Instead the left and right channels are worked on
+ * together as a pair of doubles, which is as wide as it gets; the AVX2 table
+ * uses this version too. */
+
+TARGET ("sse2") static void crossfeed_sse2 (DSPCrossfeed * cf, float * data,
+ int frames)
+{
+    __m128d lo_a0 = _mm_set1_pd (cf->lo_a0);
+    __m128d lo_b1 = _mm_set1_pd (cf->lo_b1);
+    __m128d hi_a0 = _mm_set1_pd (cf->hi_a0);
+    __m128d hi_a1 = _mm_set1_pd (cf->hi_a1);
+    __m128d hi_b1 = _mm_set1_pd (cf->hi_b1);
+    __m128d gain = _mm_set1_pd (cf->gain);
+    __m128d lower = _mm_set1_pd (-1);
+    __m128d upper = _mm_set1_pd (1);
+    __m128d lo = _mm_loadu_pd (cf->lo);
+    __m128d hi = _mm_loadu_pd (cf->hi);
+    __m128d last = _mm_loadu_pd (cf->last);
+
+    while (frames --)
+    {
+        __m128d x = _mm_cvtps_pd (_mm_castsi128_ps (_mm_loadl_epi64 ((__m128i *) data)));
+
+        lo = _mm_add_pd (_mm_mul_pd (lo_a0, x), _mm_mul_pd (lo_b1, lo));
+        hi = _mm_add_pd (_mm_add_pd (_mm_mul_pd (hi_a0, x), _mm_mul_pd (hi_a1,
+         last)), _mm_mul_pd (hi_b1, hi));
+        last = x;
+
+        __m128d y = _mm_mul_pd (_mm_add_pd (hi, _mm_shuffle_pd (lo, lo, 1)), gain);
+        y = _mm_min_pd (_mm_max_pd (y, lower), upper);
+
+        _mm_storel_epi64 ((__m128i *) data, _mm_castps_si128 (_mm_cvtpd_ps (y)));
+
+        data += 2;
+    }
+
+    _mm_storeu_pd (cf->lo, lo);
+    _mm_storeu_pd (cf->hi, hi);
+    _mm_storeu_pd (cf->last, last);
+}
+
+/* The spectra are stored with all the real parts first and then all the
+ * imaginary parts, so no shuffling is needed. */
+
+TARGET ("sse2") static void spectrum_mac_sse2 (float * acc, const float * a,
+ const float * b, int bins)
+{
+    float * acc_im = acc + bins;
+    const float * a_im = a + bins, * b_im = b + bins;
+    int i = 0;
+
+    for (; i + 4 <= bins; i += 4)
+    {
+        __m128 ar = _mm_loadu_ps (a + i), ai = _mm_loadu_ps (a_im + i);
+        __m128 br = _mm_loadu_ps (b + i), bi = _mm_loadu_ps (b_im + i);
+
+        _mm_storeu_ps (acc + i, _mm_add_ps (_mm_loadu_ps (acc + i),
+         _mm_sub_ps (_mm_mul_ps (ar, br), _mm_mul_ps (ai, bi))));
+        _mm_storeu_ps (acc_im + i, _mm_add_ps (_mm_loadu_ps (acc_im + i),
+         _mm_add_ps (_mm_mul_ps (ar, bi), _mm_mul_ps (ai, br))));
+    }
+
+    for (; i < bins; i ++)
+    {
+        acc[i] += a[i] * b[i] - a_im[i] * b_im[i];
+        acc_im[i] += a[i] * b_im[i] + a_im[i] * b[i];
+    }
+}
+
+TARGET ("avx2") static void spectrum_mac_avx2 (float * acc, const float * a,
+ const float * b, int bins)
+{
+    float * acc_im = acc + bins;
+    const float * a_im = a + bins, * b_im = b + bins;
+    int i = 0;
+
+    for (; i + 8 <= bins; i += 8)
+    {
+        __m256 ar = _mm256_loadu_ps (a + i), ai = _mm256_loadu_ps (a_im + i);
+        __m256 br = _mm256_loadu_ps (b + i), bi = _mm256_loadu_ps (b_im + i);
+
+        _mm256_storeu_ps (acc + i, _mm256_add_ps (_mm256_loadu_ps (acc + i),
+         _mm256_sub_ps (_mm256_mul_ps (ar, br), _mm256_mul_ps (ai, bi))));
+        _mm256_storeu_ps (acc_im + i, _mm256_add_ps (_mm256_loadu_ps (acc_im + i),
+         _mm256_add_ps (_mm256_mul_ps (ar, bi), _mm256_mul_ps (ai, br))));
+    }
+
+    for (; i < bins; i ++)
+    {
+        acc[i] += a[i] * b[i] - a_im[i] * b_im[i];
+        acc_im[i] += a[i] * b_im[i] + a_im[i] * b[i];
+    }
+}
+
+TARGET ("sse2") static void interleave_stereo_16_sse2 (const int16_t * left,
+ const int16_t * right, int16_t * out, int frames)
+{
+    int i = 0;
+
+    for (; i + 8 <= frames; i += 8)
+    {
+        __m128i l = _mm_loadu_si128 ((const __m128i *) (left + i));
+        __m128i r = _mm_loadu_si128 ((const __m128i *) (right + i));
+
+        _mm_storeu_si128 ((__m128i *) (out + 2 * i), _mm_unpacklo_epi16 (l, r));
+        _mm_storeu_si128 ((__m128i *) (out + 2 * i + 8), _mm_unpackhi_epi16 (l, r));
+    }
+
+    interleave_stereo_16_c (left + i, right + i, out + 2 * i, frames - i);
+}
+
+TARGET ("sse2") static void interleave_stereo_32_sse2 (const int32_t * left,
+ const int32_t * right, int32_t * out, int frames)
+{
+    int i = 0;
+
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m128i l = _mm_loadu_si128 ((const __m128i *) (left + i));
+        __m128i r = _mm_loadu_si128 ((const __m128i *) (right + i));
+
+        _mm_storeu_si128 ((__m128i *) (out + 2 * i), _mm_unpacklo_epi32 (l, r));
+        _mm_storeu_si128 ((__m128i *) (out + 2 * i + 4), _mm_unpackhi_epi32 (l, r));
+    }
+
+    interleave_stereo_32_c (left + i, right + i, out + 2 * i, frames - i);
+}
+
+/* The AVX2 unpack instructions work within each 128-bit half, so the halves
+ * of the two results are then swapped into order. */
+
+TARGET ("avx2") static void interleave_stereo_16_avx2 (const int16_t * left,
+ const int16_t * right, int16_t * out, int frames)
+{
+    int i = 0;
+
+    for (; i + 16 <= frames; i += 16)
+    {
+        __m256i l = _mm256_loadu_si256 ((const __m256i *) (left + i));
+        __m256i r = _mm256_loadu_si256 ((const __m256i *) (right + i));
+        __m256i lo = _mm256_unpacklo_epi16 (l, r);
+        __m256i hi = _mm256_unpackhi_epi16 (l, r);
+
+        _mm256_storeu_si256 ((__m256i *) (out + 2 * i),
+         _mm256_permute2x128_si256 (lo, hi, 0x20));
+        _mm256_storeu_si256 ((__m256i *) (out + 2 * i + 16),
+         _mm256_permute2x128_si256 (lo, hi, 0x31));
+    }
+
+    interleave_stereo_16_sse2 (left + i, right + i, out + 2 * i, frames - i);
+}
+
+TARGET ("avx2") static void interleave_stereo_32_avx2 (const int32_t * left,
+ const int32_t * right, int32_t * out, int frames)
+{
+    int i = 0;
+
+    for (; i + 8 <= frames; i += 8)
+    {
+        __m256i l = _mm256_loadu_si256 ((const __m256i *) (left + i));
+        __m256i r = _mm256_loadu_si256 ((const __m256i *) (right + i));
+        __m256i lo = _mm256_unpacklo_epi32 (l, r);
+        __m256i hi = _mm256_unpackhi_epi32 (l, r);
+
+        _mm256_storeu_si256 ((__m256i *) (out + 2 * i),
+         _mm256_permute2x128_si256 (lo, hi, 0x20));
+        _mm256_storeu_si256 ((__m256i *) (out + 2 * i + 8),
+         _mm256_permute2x128_si256 (lo, hi, 0x31));
+    }
+
+    interleave_stereo_32_sse2 (left + i, right + i, out + 2 * i, frames - i);
+}
+
+static const DSPKernels kernels_sse2 = {ramp_sse2, mix_sse2, abs_sum_sse2,
+ mix_mul_sse2, dot_sse2, remix_sse2, stereo_sse2, crossfeed_sse2,
+ spectrum_mac_sse2, interleave_stereo_16_sse2, interleave_stereo_32_sse2};
+static const DSPKernels kernels_avx2 = {ramp_avx2, mix_avx2, abs_sum_avx2,
+ mix_mul_avx2, dot_avx2, remix_avx2, stereo_avx2, crossfeed_sse2,
+ spectrum_mac_avx2, interleave_stereo_16_avx2, interleave_stereo_32_avx2};
+
+#endif /* DSP_X86 */
+
+#ifdef DSP_NEON
+
+static void ramp_neon (float * data, int length, float a, float b)
+{
+    static const float first[4] = {0, 1, 2, 3};
+    float step = (b - a) / length;
+    float32x4_t va = vdupq_n_f32 (a);
+    float32x4_t vstep = vdupq_n_f32 (step);
+    float32x4_t index = vld1q_f32 (first);
+    float32x4_t four = vdupq_n_f32 (4);
+    int i = 0;
+
+    for (; i + 4 <= length; i += 4)
+    {
+        float32x4_t gain = vaddq_f32 (va, vmulq_f32 (vstep, index));
+        vst1q_f32 (data + i, vmulq_f32 (vld1q_f32 (data + i), gain));
+        index = vaddq_f32 (index, four);
+    }
+
+    for (; i < length; i ++)
+        data[i] *= a + step * i;
+}
+
+static void mix_neon (float * data, const float * add, int length)
+{
+    int i = 0;
+
+    for (; i + 4 <= length; i += 4)
+        vst1q_f32 (data + i, vaddq_f32 (vld1q_f32 (data + i), vld1q_f32 (add + i)));
+
+    for (; i < length; i ++)
+        data[i] += add[i];
+}
+
+static float abs_sum_neon (const float * data, int length)
+{
+    float32x4_t sum0 = vdupq_n_f32 (0);
+    float32x4_t sum1 = vdupq_n_f32 (0);
+    int i = 0;
+
+    for (; i + 8 <= length; i += 8)
+    {
+        sum0 = vaddq_f32 (sum0, vabsq_f32 (vld1q_f32 (data + i)));
+        sum1 = vaddq_f32 (sum1, vabsq_f32 (vld1q_f32 (data + i + 4)));
+    }
+
+    float part[4];
+    vst1q_f32 (part, vaddq_f32 (sum0, sum1));
+    float sum = (part[0] + part[1]) + (part[2] + part[3]);
+
+    for (; i < length; i ++)
+        sum += fabsf (data[i]);
+
+    return sum;
+}
+
+static void mix_mul_neon (float * data, const float * add, const float * gain, int length)
+{
+    int i = 0;
+
+    for (; i + 4 <= length; i += 4)
+        vst1q_f32 (data + i, vaddq_f32 (vld1q_f32 (data + i),
+         vmulq_f32 (vld1q_f32 (add + i), vld1q_f32 (gain + i))));
+
+    for (; i < length; i ++)
+        data[i] += add[i] * gain[i];
+}
+
+static float dot_neon (const float * a, const float * b, int length)
+{
+    float32x4_t sum0 = vdupq_n_f32 (0);
+    float32x4_t sum1 = vdupq_n_f32 (0);
+    int i = 0;
+
+    for (; i + 8 <= length; i += 8)
+    {
+        sum0 = vaddq_f32 (sum0, vmulq_f32 (vld1q_f32 (a + i), vld1q_f32 (b + i)));
+        sum1 = vaddq_f32 (sum1, vmulq_f32 (vld1q_f32 (a + i + 4), vld1q_f32 (b + i + 4)));
+    }
+
+    float part[4];
+    vst1q_f32 (part, vaddq_f32 (sum0, sum1));
+    float sum = (part[0] + part[1]) + (part[2] + part[3]);
+
+    for (; i < length; i ++)
+        sum += a[i] * b[i];
+
+    return sum;
+}
+
+static void remix_neon (const float * in, int in_channels, float * out, int
+ out_channels, const float * matrix, int frames)
+{
+    float columns[DSP_MAX_CHANNELS][8];
+    float32x4_t lo[DSP_MAX_CHANNELS], hi[DSP_MAX_CHANNELS];
+
+    remix_columns (in_channels, out_channels, matrix, columns);
+
+    for (int i = 0; i < in_channels; i ++)
+    {
+        lo[i] = vld1q_f32 (columns[i]);
+        hi[i] = vld1q_f32 (columns[i] + 4);
+    }
+
+    int width = (out_channels > 4) ? 8 : 4;
+
+    for (; frames * out_channels >= width + out_channels; frames --)
+    {
+        float32x4_t a = vdupq_n_f32 (0);
+        float32x4_t b = vdupq_n_f32 (0);
+
+        for (int i = 0; i < in_channels; i ++)
+        {
+            float32x4_t v = vdupq_n_f32 (in[i]);
+            a = vaddq_f32 (a, vmulq_f32 (v, lo[i]));
+            b = vaddq_f32 (b, vmulq_f32 (v, hi[i]));
+        }
+
+        vst1q_f32 (out, a);
+        if (width == 8)
+            vst1q_f32 (out + 4, b);
+
+        in += in_channels;
+        out += out_channels;
+    }
+
+    remix_c (in, in_channels, out, out_channels, matrix, frames);
+}
+
+static void stereo_neon (float * data, int frames, float * prev, float
+ sharpen, float mid, float side)
+{
+    float init[4] = {0, 0, prev[0], prev[1]};
+    float32x4_t last = vld1q_f32 (init);
+    float32x4_t vsharpen = vdupq_n_f32 (sharpen);
+    float32x4_t vmid = vdupq_n_f32 (mid);
+    float32x4_t vside = vdupq_n_f32 (side);
+    float32x4_t half = vdupq_n_f32 (0.5f);
+
+    for (; frames >= 2; frames -= 2)
+    {
+        float32x4_t v = vld1q_f32 (data);
+        float32x4_t p = vextq_f32 (last, v, 2);
+        float32x4_t x = vaddq_f32 (v, vmulq_f32 (vsubq_f32 (v, p), vsharpen));
+        float32x4_t swap = vrev64q_f32 (x);
+        float32x4_t m = vmulq_f32 (vaddq_f32 (x, swap), half);
+        float32x4_t s = vmulq_f32 (vsubq_f32 (x, swap), half);
+
+        vst1q_f32 (data, vaddq_f32 (vmulq_f32 (m, vmid), vmulq_f32 (s, vside)));
+
+        last = v;
+        data += 4;
+    }
+
+    prev[0] = vgetq_lane_f32 (last, 2);
+    prev[1] = vgetq_lane_f32 (last, 3);
+
+    stereo_c (data, frames, prev, sharpen, mid, side);
+}
+
+/* NEON only has doubles on 64-bit ARM. */
+
+#ifdef __aarch64__
+
+static void crossfeed_neon (DSPCrossfeed * cf, float * data, int frames)
+{
+    float64x2_t lo_a0 = vdupq_n_f64 (cf->lo_a0);
+    float64x2_t lo_b1 = vdupq_n_f64 (cf->lo_b1);
+    float64x2_t hi_a0 = vdupq_n_f64 (cf->hi_a0);
+    float64x2_t hi_a1 = vdupq_n_f64 (cf->hi_a1);
+    float64x2_t hi_b1 = vdupq_n_f64 (cf->hi_b1);
+    float64x2_t gain = vdupq_n_f64 (cf->gain);
+    float64x2_t lower = vdupq_n_f64 (-1);
+    float64x2_t upper = vdupq_n_f64 (1);
+    float64x2_t lo = vld1q_f64 (cf->lo);
+    float64x2_t hi = vld1q_f64 (cf->hi);
+    float64x2_t last = vld1q_f64 (cf->last);
+
+    while (frames --)
+    {
+        float64x2_t x = vcvt_f64_f32 (vld1_f32 (data));
+
+        lo = vaddq_f64 (vmulq_f64 (lo_a0, x), vmulq_f64 (lo_b1, lo));
+        hi = vaddq_f64 (vaddq_f64 (vmulq_f64 (hi_a0, x), vmulq_f64 (hi_a1,
+         last)), vmulq_f64 (hi_b1, hi));
+        last = x;
+
+        float64x2_t y = vmulq_f64 (vaddq_f64 (hi, vextq_f64 (lo, lo, 1)), gain);
+        y = vminq_f64 (vmaxq_f64 (y, lower), upper);
+
+        vst1_f32 (data, vcvt_f32_f64 (y));
+
+        data += 2;
+    }
+
+    vst1q_f64 (cf->lo, lo);
+    vst1q_f64 (cf->hi, hi);
+    vst1q_f64 (cf->last, last);
+}
+
+#else
+#define crossfeed_neon crossfeed_c
+#endif
+
+static void spectrum_mac_neon (float * acc, const float * a, const float * b,
+ int bins)
+{
+    float * acc_im = acc + bins;
+    const float * a_im = a + bins, * b_im = b + bins;
+    int i = 0;
+
+    for (; i + 4 <= bins; i += 4)
+    {
+        float32x4_t ar = vld1q_f32 (a + i), ai = vld1q_f32 (a_im + i);
+        float32x4_t br = vld1q_f32 (b + i), bi = vld1q_f32 (b_im + i);
+
+        vst1q_f32 (acc + i, vaddq_f32 (vld1q_f32 (acc + i), vsubq_f32
+         (vmulq_f32 (ar, br), vmulq_f32 (ai, bi))));
+        vst1q_f32 (acc_im + i, vaddq_f32 (vld1q_f32 (acc_im + i), vaddq_f32
+         (vmulq_f32 (ar, bi), vmulq_f32 (ai, br))));
+    }
+
+    for (; i < bins; i ++)
+    {
+        acc[i] += a[i] * b[i] - a_im[i] * b_im[i];
+        acc_im[i] += a[i] * b_im[i] + a_im[i] * b[i];
+    }
+}
+
+static void interleave_stereo_16_neon (const int16_t * left, const int16_t *
+ right, int16_t * out, int frames)
+{
+    int i = 0;
+
+    for (; i + 8 <= frames; i += 8)
+    {
+        int16x8x2_t v = {{vld1q_s16 (left + i), vld1q_s16 (right + i)}};
+        vst2q_s16 (out + 2 * i, v);
+    }
+
+    interleave_stereo_16_c (left + i, right + i, out + 2 * i, frames - i);
+}
+
+static void interleave_stereo_32_neon (const int32_t * left, const int32_t *
+ right, int32_t * out, int frames)
+{
+    int i = 0;
+
+    for (; i + 4 <= frames; i += 4)
+    {
+        int32x4x2_t v = {{vld1q_s32 (left + i), vld1q_s32 (right + i)}};
+        vst2q_s32 (out + 2 * i, v);
+    }
+
+    interleave_stereo_32_c (left + i, right + i, out + 2 * i, frames - i);
+}
+
+static const DSPKernels kernels_neon = {ramp_neon, mix_neon, abs_sum_neon,
+ mix_mul_neon, dot_neon, remix_neon, stereo_neon, crossfeed_neon,
+ spectrum_mac_neon, interleave_stereo_16_neon, interleave_stereo_32_neon};
+
+#endif /* DSP_NEON */
+
+static DSPKernels kernels;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void select_kernels (void)
+{
+    kernels = kernels_c;
+
+#if defined (DSP_X86)
+    __builtin_cpu_init ();
+
+    if (__builtin_cpu_supports ("avx2"))
+        kernels = kernels_avx2;
+    else if (__builtin_cpu_supports ("sse2"))
+        kernels = kernels_sse2;
+#elif defined (DSP_NEON)
+    kernels = kernels_neon;
+#endif
+}
+
+void dsp_ramp (float * data, int length, float a, float b)
+{
+    if (length <= 0)
+        return;
+
+    pthread_once (& kernels_once, select_kernels);
+    kernels.ramp (data, length, a, b);
+}
+
+void dsp_mix (float * data, const float * add, int length)
+{
+    if (length <= 0)
+        return;
+
+    pthread_once (& kernels_once, select_kernels);
+    kernels.mix (data, add, length);
+}
+
+float dsp_abs_sum (const float * data, int length)
+{
+    if (length <= 0)
+        return 0;
+
+    pthread_once (& kernels_once, select_kernels);
+    return kernels.abs_sum (data, length);
+}
+
+void dsp_mix_mul (float * data, const float * add, const float * gain, int length)
+{
+    if (length <= 0)
+        return;
+
+    pthread_once (& kernels_once, select_kernels);
+    kernels.mix_mul (data, add, gain, length);
+}
+
+float dsp_dot (const float * a, const float * b, int length)
+{
+    if (length <= 0)
+        return 0;
+
+    pthread_once (& kernels_once, select_kernels);
+    return kernels.dot (a, b, length);
+}
+
+void dsp_remix (const float * in, int in_channels, float * out, int
+ out_channels, const float * matrix, int frames)
+{
+    if (frames <= 0)
+        return;
+
+    pthread_once (& kernels_once, select_kernels);
+    kernels.remix (in, in_channels, out, out_channels, matrix, frames);
+}
+
+void dsp_stereo (float * data, int frames, float * prev, float sharpen, float
+ mid, float side)
+{
+    if (frames <= 0)
+        return;
+
+    pthread_once (& kernels_once, select_kernels);
+    kernels.stereo (data, frames, prev, sharpen, mid, side);
+}
+
+void dsp_crossfeed (DSPCrossfeed * cf, float * data, int frames)
+{
+    if (frames <= 0)
+        return;
+
+    pthread_once (& kernels_once, select_kernels);
+    kernels.crossfeed (cf, data, frames);
+}
+
+void dsp_spectrum_mac (float * acc, const float * a, const float * b, int bins)
+{
+    if (bins <= 0)
+        return;
+
+    pthread_once (& kernels_once, select_kernels);
+    kernels.spectrum_mac (acc, a, b, bins);
+}
+
+void dsp_interleave (const void * const * planes, int sample_size, int
+ channels, void * out, int frames)
+{
+    if (frames <= 0)
+        return;
+
+    if (channels == 1)
+    {
+        memcpy (out, planes[0], (size_t) sample_size * frames);
+        return;
+    }
+
+    if (channels == 2 && (sample_size == 2 || sample_size == 4))
+    {
+        pthread_once (& kernels_once, select_kernels);
+
+        if (sample_size == 2)
+            kernels.interleave_stereo_16 (planes[0], planes[1], out, frames);
+        else
+            kernels.interleave_stereo_32 (planes[0], planes[1], out, frames);
+
+        return;
+    }
+
+    interleave_c (planes, sample_size, channels, out, frames);
+}
@@ -0,0 +1,59 @@
+/*
+ * Lock-Free Effect Settings for Audacious Effect Plugins
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef AUD_DSP_PARAMS_H
+#define AUD_DSP_PARAMS_H
+
+#include <stdint.h>
+
+/* Settings which an effect reads on every block are kept packed into a single
+ * 64-bit word instead of being fetched with aud_get_*, which takes the global
+ * configuration lock and looks the setting up by name.  The main thread packs
+ * the settings and publishes them with one atomic store whenever they change
+ * (from the preferences callback, or from the plugin's own dialog); the audio
+ * thread unpacks them after one atomic load and never has to wait.
+ *
+ * The members overlap: f[0], i[0], and s[0] and s[1] are the same four bytes.
+ * Settings of different types which will not fit side by side in one view
+ * need a second store. */
+
+typedef union {
+    uint64_t word;
+    float f[2];
+    int32_t i[2];
+    int16_t s[4];
+} DSPParams;
+
+typedef struct {
+    uint64_t word __attribute__ ((aligned (8)));
+} DSPParamStore;
+
+static inline void dsp_params_publish (DSPParamStore * store, DSPParams params)
+{
+    __atomic_store_n (& store->word, params.word, __ATOMIC_RELEASE);
+}
+
+static inline DSPParams dsp_params_read (DSPParamStore * store)
+{
+    DSPParams params;
+    params.word = __atomic_load_n (& store->word, __ATOMIC_ACQUIRE);
+    return params;
+}
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ * Shared DSP Kernels for Audacious Effect Plugins
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <string.h>
+
+#include "dsp.h"
+
+enum {
+    FL, /* front left */
+    FR, /* front right */
+    FC, /* front center */
+    LFE, /* low frequency */
+    BL, /* back left */
+    BR, /* back right */
+    BC, /* back center */
+    SL, /* side left */
+    SR, /* side right */
+    N_SPEAKERS
+};
+
+static const char layouts[DSP_MAX_CHANNELS + 1][DSP_MAX_CHANNELS] = {
+ [1] = {FC},
+ [2] = {FL, FR},
+ [3] = {FL, FR, FC},
+ [4] = {FL, FR, BL, BR},
+ [5] = {FL, FR, FC, BL, BR},
+ [6] = {FL, FR, FC, LFE, BL, BR},
+ [7] = {FL, FR, FC, LFE, BC, SL, SR},
+ [8] = {FL, FR, FC, LFE, BL, BR, SL, SR}};
+
+#define HALF_POWER 0.70710678f
+
+typedef struct {
+    float * matrix;
+    int in_channels;
+    int out_index[N_SPEAKERS];
+} Router;
+
+/* Sends the signal meant for <speaker> to the output channel for that speaker,
+ * or spreads it over the nearest speakers present in the output layout.  Each
+ * fallback moves toward the front, and the front left and right speakers only
+ * go missing in mono, so this always terminates. */
+static void route (Router * r, int in, int speaker, float gain)
+{
+    if (r->out_index[speaker] >= 0)
+    {
+        r->matrix[r->out_index[speaker] * r->in_channels + in] += gain;
+        return;
+    }
+
+    switch (speaker)
+    {
+    case FL:
+    case FR:
+        route (r, in, FC, gain * 0.5f);
+        break;
+    case FC:
+        route (r, in, FL, gain * HALF_POWER);
+        route (r, in, FR, gain * HALF_POWER);
+        break;
+    case LFE:
+        route (r, in, FL, gain * 0.5f);
+        route (r, in, FR, gain * 0.5f);
+        break;
+    case BL:
+    case BR:
+        if (r->out_index[speaker == BL ? SL : SR] >= 0)
+            route (r, in, speaker == BL ? SL : SR, gain);
+        else if (r->out_index[BC] >= 0)
+            route (r, in, BC, gain * HALF_POWER);
+        else
+            route (r, in, speaker == BL ? FL : FR, gain * HALF_POWER);
+        break;
+    case BC:
+        if (r->out_index[BL] >= 0 && r->out_index[BR] >= 0)
+        {
+            route (r, in, BL, gain * HALF_POWER);
+            route (r, in, BR, gain * HALF_POWER);
+        }
+        else if (r->out_index[SL] >= 0 && r->out_index[SR] >= 0)
+        {
+            route (r, in, SL, gain * HALF_POWER);
+            route (r, in, SR, gain * HALF_POWER);
+        }
+        else
+        {
+            route (r, in, FL, gain * 0.5f);
+            route (r, in, FR, gain * 0.5f);
+        }
+        break;
+    case SL:
+    case SR:
+        if (r->out_index[speaker == SL ? BL : BR] >= 0)
+            route (r, in, speaker == SL ? BL : BR, gain);
+        else
+            route (r, in, speaker == SL ? FL : FR, gain * HALF_POWER);
+        break;
+    }
+}
+
+void dsp_remix_matrix (int in_channels, int out_channels, float * matrix)
+{
+    Router r = {.matrix = matrix, .in_channels = in_channels};
+
+    memset (matrix, 0, sizeof (float) * in_channels * out_channels);
+
+    for (int s = 0; s < N_SPEAKERS; s ++)
+        r.out_index[s] = -1;
+    for (int o = 0; o < out_channels; o ++)
+        r.out_index[(int) layouts[out_channels][o]] = o;
+
+    /* Mono is played at full volume on both front speakers unless there is a
+     * center speaker to play it on. */
+    if (in_channels == 1 && r.out_index[FC] < 0)
+    {
+        matrix[r.out_index[FL]] = 1;
+        matrix[r.out_index[FR]] = 1;
+        return;
+    }
+
+    for (int i = 0; i < in_channels; i ++)
+        route (& r, i, layouts[in_channels][i], 1);
+}
@@ -0,0 +1,164 @@
+/*
+ * Shared DSP Kernels for Audacious Effect Plugins
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "dsp.h"
+
+/* The filter is a sinc function cut off after SINC_ZEROS zero crossings on
+ * each side and shaped with a Blackman window.  It is tabulated at SINC_STEPS
+ * points per zero crossing and linearly interpolated in between. */
+#define SINC_ZEROS 8
+#define SINC_STEPS 256
+
+#define CLAMP_FRAME(k, frames) ((k) < 0 ? 0 : (k) >= (frames) ? (frames) - 1 : (k))
+
+static float sinc_table[SINC_ZEROS * SINC_STEPS + 2];
+static pthread_once_t sinc_once = PTHREAD_ONCE_INIT;
+
+static void fill_sinc_table (void)
+{
+    sinc_table[0] = 1;
+
+    for (int i = 1; i <= SINC_ZEROS * SINC_STEPS; i ++)
+    {
+        double x = M_PI * i / SINC_STEPS;
+        double w = M_PI * i / (SINC_ZEROS * SINC_STEPS);
+        double window = 0.42 + 0.5 * cos (w) + 0.08 * cos (2 * w);
+        sinc_table[i] = sin (x) / x * window;
+    }
+
+    sinc_table[SINC_ZEROS * SINC_STEPS + 1] = 0;
+}
+
+static float sinc (double x)
+{
+    double pos = fabs (x) * SINC_STEPS;
+    int i = (int) pos;
+
+    if (i >= SINC_ZEROS * SINC_STEPS)
+        return 0;
+
+    float frac = pos - i;
+    return sinc_table[i] + (sinc_table[i + 1] - sinc_table[i]) * frac;
+}
+
+void dsp_resample (const float * in, int in_frames, float * out, int
+ out_frames, int channels)
+{
+    dsp_resample_part (in, in_frames, out, out_frames, channels, 0, out_frames);
+}
+
+void dsp_resample_part (const float * in, int in_frames, float * out, int
+ out_frames, int channels, int first_out, int count)
+{
+    if (in_frames <= 0 || out_frames <= 0 || count <= 0)
+        return;
+
+    if (in_frames == out_frames)
+    {
+        memcpy (out, in + channels * first_out, sizeof (float) * channels *
+         count);
+        return;
+    }
+
+    pthread_once (& sinc_once, fill_sinc_table);
+
+    /* When reducing the rate, the cutoff frequency is lowered and the filter
+     * widened in proportion to avoid aliasing. */
+    double step = (double) in_frames / out_frames;
+    double cutoff = (step > 1) ? 1 / step : 1;
+    double half = SINC_ZEROS / cutoff;
+
+    for (int j = first_out; j < first_out + count; j ++)
+    {
+        /* Frame centers are lined up so that both blocks cover the same span
+         * of time. */
+        double center = (j + 0.5) * step - 0.5;
+        int first = (int) ceil (center - half);
+        int last = (int) floor (center + half);
+        float * set = out + channels * (j - first_out);
+        float total = 0;
+
+        memset (set, 0, sizeof (float) * channels);
+
+        for (int k = first; k <= last; k ++)
+        {
+            float weight = sinc ((k - center) * cutoff);
+            const float * get = in + channels * CLAMP_FRAME (k, in_frames);
+
+            for (int c = 0; c < channels; c ++)
+                set[c] += get[c] * weight;
+
+            total += weight;
+        }
+
+        /* Normalizing keeps the gain at exactly 1 even at the edges of the
+         * block, where the first and last frames are repeated. */
+        if (total != 0)
+        {
+            float scale = 1 / total;
+
+            for (int c = 0; c < channels; c ++)
+                set[c] *= scale;
+        }
+    }
+}
+
+void dsp_true_peak_filter (float * filter)
+{
+    for (int p = 1; p < DSP_TP_PHASES; p ++)
+    {
+        float * f = filter + DSP_TP_TAPS * (p - 1);
+        float sum = 0;
+
+        for (int t = 0; t < DSP_TP_TAPS; t ++)
+        {
+            double x = t - (DSP_TP_HALF - 1) - (double) p / DSP_TP_PHASES;
+            double sinc = (x == 0) ? 1 : sin (M_PI * x) / (M_PI * x);
+            double window = 0.5 + 0.5 * cos (M_PI * x / DSP_TP_HALF);
+
+            f[t] = sinc * window;
+            sum += f[t];
+        }
+
+        for (int t = 0; t < DSP_TP_TAPS; t ++)
+            f[t] /= sum;
+    }
+}
+
+float dsp_true_peak (const float * taps, const float * filter)
+{
+    float peak = fabsf (taps[DSP_TP_HALF - 1]);
+
+    for (int p = 0; p < DSP_TP_PHASES - 1; p ++)
+    {
+        const float * f = filter + DSP_TP_TAPS * p;
+        float sum = 0;
+
+        for (int t = 0; t < DSP_TP_TAPS; t ++)
+            sum += taps[t] * f[t];
+
+        peak = fmaxf (peak, fabsf (sum));
+    }
+
+    return peak;
+}
@@ -0,0 +1,181 @@
+/*
+ * Shared DSP Kernels for Audacious Effect Plugins
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "dsp.h"
+
+struct DSPWorkers {
+    pthread_mutex_t mutex;
+    pthread_cond_t start_cond, done_cond;
+    pthread_t * threads;
+    int n_threads;
+
+    /* the current job, protected by the mutex */
+    void (* func) (void * data, int index);
+    void * data;
+    int count, next, running;
+    unsigned generation;
+    int quit;
+};
+
+/* Takes indexes from the current job until there are none left.  Called with
+ * the mutex locked. */
+static void run_job (DSPWorkers * w)
+{
+    while (w->next < w->count)
+    {
+        int index = w->next ++;
+        w->running ++;
+
+        pthread_mutex_unlock (& w->mutex);
+        w->func (w->data, index);
+        pthread_mutex_lock (& w->mutex);
+
+        w->running --;
+    }
+
+    if (! w->running)
+        pthread_cond_broadcast (& w->done_cond);
+}
+
+static void * worker_thread (void * arg)
+{
+    DSPWorkers * w = arg;
+    unsigned seen = 0;
+
+    pthread_mutex_lock (& w->mutex);
+
+    while (1)
+    {
+        while (! w->quit && w->generation == seen)
+            pthread_cond_wait (& w->start_cond, & w->mutex);
+
+        if (w->quit)
+            break;
+
+        seen = w->generation;
+        run_job (w);
+    }
+
+    pthread_mutex_unlock (& w->mutex);
+    return NULL;
+}
+
+DSPWorkers * dsp_workers_new (int threads)
+{
+    DSPWorkers * w = calloc (1, sizeof (DSPWorkers));
+
+    pthread_mutex_init (& w->mutex, NULL);
+    pthread_cond_init (& w->start_cond, NULL);
+    pthread_cond_init (& w->done_cond, NULL);
+
+    w->threads = calloc (threads > 1 ? threads - 1 : 1, sizeof (pthread_t));
+
+    for (int i = 0; i < threads - 1; i ++)
+    {
+        if (pthread_create (& w->threads[i], NULL, worker_thread, w))
+            break;
+
+        w->n_threads ++;
+    }
+
+    return w;
+}
+
+void dsp_workers_free (DSPWorkers * w)
+{
+    pthread_mutex_lock (& w->mutex);
+    w->quit = 1;
+    pthread_cond_broadcast (& w->start_cond);
+    pthread_mutex_unlock (& w->mutex);
+
+    for (int i = 0; i < w->n_threads; i ++)
+        pthread_join (w->threads[i], NULL);
+
+    pthread_cond_destroy (& w->start_cond);
+    pthread_cond_destroy (& w->done_cond);
+    pthread_mutex_destroy (& w->mutex);
+    free (w->threads);
+    free (w);
+}
+
+void dsp_workers_run (DSPWorkers * w, void (* func) (void * data, int
+ index), void * data, int count)
+{
+    if (! w->n_threads || count < 2)
+    {
+        for (int i = 0; i < count; i ++)
+            func (data, i);
+
+        return;
+    }
+
+    pthread_mutex_lock (& w->mutex);
+
+    w->func = func;
+    w->data = data;
+    w->count = count;
+    w->next = 0;
+    w->generation ++;
+    pthread_cond_broadcast (& w->start_cond);
+
+    /* The calling thread does its share of the work too, then waits for any
+     * calls still running in the pool. */
+    run_job (w);
+
+    while (w->running)
+        pthread_cond_wait (& w->done_cond, & w->mutex);
+
+    pthread_mutex_unlock (& w->mutex);
+}
+
+void dsp_workers_start (DSPWorkers * w, void (* func) (void * data, int
+ index), void * data, int count)
+{
+    if (! w->n_threads)
+    {
+        for (int i = 0; i < count; i ++)
+            func (data, i);
+
+        return;
+    }
+
+    pthread_mutex_lock (& w->mutex);
+
+    w->func = func;
+    w->data = data;
+    w->count = count;
+    w->next = 0;
+    w->generation ++;
+    pthread_cond_broadcast (& w->start_cond);
+
+    pthread_mutex_unlock (& w->mutex);
+}
+
+void dsp_workers_wait (DSPWorkers * w)
+{
+    pthread_mutex_lock (& w->mutex);
+
+    while (w->next < w->count || w->running)
+        pthread_cond_wait (& w->done_cond, & w->mutex);
+
+    pthread_mutex_unlock (& w->mutex);
+}
@@ -1,3 +1,4 @@
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -6,13 +7,14 @@
 #include <audacious/plugin.h>
 #include <audacious/preferences.h>
 
+#include "dsp/params.h"
+
 #define MAX_DELAY 1000
-#define MAX_SRATE 50000
-#define MAX_CHANNELS 2
-#define BYTES_PS sizeof(float)
-#define BUFFER_SAMPLES (MAX_SRATE * MAX_DELAY / 1000)
-#define BUFFER_SHORTS (BUFFER_SAMPLES * MAX_CHANNELS)
-#define BUFFER_BYTES (BUFFER_SHORTS * BYTES_PS)
+
+/* When the delay setting changes, the delay glides to the new value instead of
+ * jumping, which would click.  This is how fast it may change, in frames per
+ * frame (0.25 shifts the pitch of the echo by a quarter while it glides). */
+#define MAX_GLIDE 0.25f
 
 static const char * const echo_defaults[] = {
  "delay", "500",
@@ -20,28 +22,48 @@ static const char * const echo_defaults[] = {
  "volume", "50",
  NULL};
 
+static void update_params (void);
+
 static const PreferencesWidget echo_widgets[] = {
  {WIDGET_LABEL, N_("<b>Echo</b>")},
  {WIDGET_SPIN_BTN, N_("Delay:"),
   .cfg_type = VALUE_INT, .csect = "echo_plugin", .cname = "delay",
+  .callback = update_params,
   .data = {.spin_btn = {0, MAX_DELAY, 10, N_("ms")}}},
  {WIDGET_SPIN_BTN, N_("Feedback:"),
   .cfg_type = VALUE_INT, .csect = "echo_plugin", .cname = "feedback",
+  .callback = update_params,
   .data = {.spin_btn = {0, 100, 1, "%"}}},
  {WIDGET_SPIN_BTN, N_("Volume:"),
   .cfg_type = VALUE_INT, .csect = "echo_plugin", .cname = "volume",
+  .callback = update_params,
   .data = {.spin_btn = {0, 100, 1, "%"}}}};
 
 static const PluginPreferences echo_prefs = {
  .widgets = echo_widgets,
  .n_widgets = sizeof echo_widgets / sizeof echo_widgets[0]};
 
+/* The delay line holds whole frames and its length is a power of two, so that
+ * positions wrap around with a mask. */
 static float *buffer = NULL;
-static int w_ofs;
+static int buffer_frames, mask;
+static int w_frame;
+static float cur_delay;
+static DSPParamStore params;
+
+static void update_params (void)
+{
+    DSPParams p = {0};
+    p.s[0] = aud_get_int ("echo_plugin", "delay");
+    p.s[1] = aud_get_int ("echo_plugin", "feedback");
+    p.s[2] = aud_get_int ("echo_plugin", "volume");
+    dsp_params_publish (& params, p);
+}
 
 static bool_t init (void)
 {
     aud_config_set_defaults ("echo_plugin", echo_defaults);
+    update_params ();
     return TRUE;
 }
 
@@ -49,6 +71,7 @@ static void cleanup(void)
 {
     free(buffer);
     buffer = NULL;
+    buffer_frames = 0;
 }
 
 static int echo_channels = 0;
@@ -58,16 +81,23 @@ static void echo_start(int *channels, int *rate)
 {
     static int old_srate, old_nch;
 
-    if (buffer == NULL)
-        buffer = malloc (BUFFER_BYTES);
-
     echo_channels = *channels;
     echo_rate = *rate;
 
-    if (echo_channels != old_nch || echo_rate != old_srate)
+    if (buffer == NULL || echo_channels != old_nch || echo_rate != old_srate)
     {
-        memset(buffer, 0, BUFFER_BYTES);
-        w_ofs = 0;
+        /* room for the longest delay plus one frame to interpolate with */
+        int needed = (int64_t) echo_rate * MAX_DELAY / 1000 + 2;
+
+        for (buffer_frames = 1; buffer_frames < needed; buffer_frames <<= 1)
+            ;
+
+        mask = buffer_frames - 1;
+        buffer = realloc(buffer, sizeof(float) * echo_channels * buffer_frames);
+        memset(buffer, 0, sizeof(float) * echo_channels * buffer_frames);
+
+        w_frame = 0;
+        cur_delay = -1; /* start at the configured delay */
         old_nch = echo_channels;
         old_srate = echo_rate;
     }
@@ -75,34 +105,51 @@ static void echo_start(int *channels, int *rate)
 
 static void echo_process(float **d, int *samples)
 {
-    int delay = aud_get_int ("echo_plugin", "delay");
-    int feedback = aud_get_int ("echo_plugin", "feedback");
-    int volume = aud_get_int ("echo_plugin", "volume");
+    DSPParams p = dsp_params_read (& params);
+    float target = (float) echo_rate * CLAMP (p.s[0], 0, MAX_DELAY) / 1000;
+    float feedback = p.s[1] / 100.0f;
+    float volume = p.s[2] / 100.0f;
 
-    float in, out, buf;
-    int r_ofs;
+    int channels = echo_channels;
+    int frames = *samples / channels;
     float *data = *d;
-    float *end = *d + *samples;
 
-    r_ofs = w_ofs - (echo_rate * delay / 1000) * echo_channels;
-    if (r_ofs < 0)
-        r_ofs += BUFFER_SHORTS;
+    if (! frames)
+        return;
+
+    /* The echo can come no sooner than the frame before. */
+    target = MAX (target, 1);
 
-    for (; data < end; data++)
+    if (cur_delay < 0)
+        cur_delay = target;
+
+    float step = CLAMP ((target - cur_delay) / frames, -MAX_GLIDE, MAX_GLIDE);
+
+    for (int f = 0; f < frames; f++)
     {
-        in = *data;
-
-        buf = buffer[r_ofs];
-        out = in + buf * volume / 100;
-        buf = in + buf * feedback / 100;
-        buffer[w_ofs] = buf;
-        *data = out;
-
-        if (++r_ofs >= BUFFER_SHORTS)
-            r_ofs -= BUFFER_SHORTS;
-        if (++w_ofs >= BUFFER_SHORTS)
-            w_ofs -= BUFFER_SHORTS;
+        /* read between two frames of the delay line */
+        float pos = w_frame - (cur_delay + step * (f + 1));
+        int whole = floorf (pos);
+        float frac = pos - whole;
+
+        float *a = buffer + channels * (whole & mask);
+        float *b = buffer + channels * ((whole + 1) & mask);
+        float *w = buffer + channels * w_frame;
+
+        for (int c = 0; c < channels; c++)
+        {
+            float in = data[c];
+            float echo = a[c] + (b[c] - a[c]) * frac;
+
+            data[c] = in + echo * volume;
+            w[c] = in + echo * feedback;
+        }
+
+        w_frame = (w_frame + 1) & mask;
+        data += channels;
     }
+
+    cur_delay += step * frames;
 }
 
 static void echo_finish(float **d, int *samples)
@@ -0,0 +1,534 @@
+/*
+ * Effect Plugin Benchmark for Audacious
+ * Copyright 2013 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/* Loads a single effect plugin outside of Audacious and runs audio through it
+ * block by block, timing each call.  The plugin sees a minimal API table which
+ * holds its settings in memory; effects which need more of Audacious than their
+ * settings (a GUI, the playlist) cannot be run this way.
+ *
+ * Usage: effect-bench [options] plugin.so
+ *
+ *  -i file       read the input from an audio file (any format libsndfile
+ *                reads) instead of generating it
+ *  -o file       write the output to a WAV file
+ *  -r rate       sample rate of the generated input (default 44100)
+ *  -c channels   channels of the generated input (default 2)
+ *  -l seconds    length of the generated input (default 10)
+ *  -b frames     frames per block (default 512)
+ *  -p passes     times to run through the input, with a flush between each
+ *  -s name=value change one of the settings the plugin sets defaults for
+ *  -t            print a single line of tab-separated values: plugin, channels,
+ *                rate, block, calls, samples in, samples out, samples/s,
+ *                times realtime, p50, p90, p99 and max time per call (us),
+ *                allocations per call, bytes allocated, latency (ms)
+ */
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <gmodule.h>
+#include <sndfile.h>
+
+#include <audacious/api.h>
+#include <audacious/misc.h>
+#include <audacious/plugin.h>
+
+typedef struct {
+    char * section, * name, * value;
+} Setting;
+
+static GArray * settings;
+static GArray * overrides;
+
+static int rate = 44100, channels = 2, seconds = 10;
+static int block = 512, passes = 1;
+static bool_t tabular;
+static const char * in_path, * out_path;
+
+/* With glibc, malloc() and friends can be replaced by the program and the real
+ * ones are still reachable under other names.  Allocations are counted only
+ * while a call into the plugin is being timed, from any thread, since effects
+ * may hand work to threads of their own. */
+
+#ifdef __GLIBC__
+
+void * __libc_malloc (size_t size);
+void * __libc_calloc (size_t count, size_t size);
+void * __libc_realloc (void * ptr, size_t size);
+
+static int counting;
+static int64_t allocs, alloc_bytes;
+
+static void count_alloc (size_t size)
+{
+    if (__atomic_load_n (& counting, __ATOMIC_RELAXED))
+    {
+        __atomic_fetch_add (& allocs, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add (& alloc_bytes, size, __ATOMIC_RELAXED);
+    }
+}
+
+void * malloc (size_t size)
+{
+    count_alloc (size);
+    return __libc_malloc (size);
+}
+
+void * calloc (size_t count, size_t size)
+{
+    count_alloc (count * size);
+    return __libc_calloc (count, size);
+}
+
+void * realloc (void * ptr, size_t size)
+{
+    count_alloc (size);
+    return __libc_realloc (ptr, size);
+}
+
+#define COUNT_ALLOCS(on) __atomic_store_n (& counting, (on), __ATOMIC_RELAXED)
+#define HAVE_ALLOC_COUNT 1
+
+#else
+
+#define COUNT_ALLOCS(on)
+#define HAVE_ALLOC_COUNT 0
+static int64_t allocs, alloc_bytes;
+
+#endif
+
+/* The settings, as the plugin sees them.  A NULL section means Audacious's
+ * own, as it does in Audacious. */
+
+static Setting * find_setting (const char * section, const char * name)
+{
+    for (int i = 0; i < settings->len; i ++)
+    {
+        Setting * s = & g_array_index (settings, Setting, i);
+        if (! strcmp (s->section, section) && ! strcmp (s->name, name))
+            return s;
+    }
+
+    return NULL;
+}
+
+static void set_string (const char * section, const char * name, const char * value)
+{
+    if (! section)
+        section = "audacious";
+
+    Setting * s = find_setting (section, name);
+
+    if (s)
+    {
+        g_free (s->value);
+        s->value = g_strdup (value);
+    }
+    else
+    {
+        Setting add = {g_strdup (section), g_strdup (name), g_strdup (value)};
+        g_array_append_val (settings, add);
+    }
+}
+
+static char * get_string (const char * section, const char * name)
+{
+    Setting * s = find_setting (section ? section : "audacious", name);
+    return g_strdup (s ? s->value : "");
+}
+
+static void set_defaults (const char * section, const char * const * entries)
+{
+    for (; entries[0] && entries[1]; entries += 2)
+    {
+        if (! find_setting (section, entries[0]))
+            set_string (section, entries[0], entries[1]);
+    }
+
+    /* "-s" settings name no section, so they go to the plugin's own. */
+    for (int i = 0; i < overrides->len; i ++)
+    {
+        Setting * o = & g_array_index (overrides, Setting, i);
+        if (find_setting (section, o->name))
+            set_string (section, o->name, o->value);
+    }
+}
+
+static void clear_section (const char * section)
+{
+    for (int i = settings->len; i --; )
+    {
+        Setting * s = & g_array_index (settings, Setting, i);
+
+        if (! strcmp (s->section, section))
+        {
+            g_free (s->section);
+            g_free (s->name);
+            g_free (s->value);
+            g_array_remove_index (settings, i);
+        }
+    }
+}
+
+static bool_t get_bool (const char * section, const char * name)
+{
+    char * value = get_string (section, name);
+    bool_t b = ! strcmp (value, "TRUE");
+    g_free (value);
+    return b;
+}
+
+static void set_bool (const char * section, const char * name, bool_t value)
+{
+    set_string (section, name, value ? "TRUE" : "FALSE");
+}
+
+static int get_int (const char * section, const char * name)
+{
+    char * value = get_string (section, name);
+    int i = atoi (value);
+    g_free (value);
+    return i;
+}
+
+static void set_int (const char * section, const char * name, int value)
+{
+    char buf[16];
+    snprintf (buf, sizeof buf, "%d", value);
+    set_string (section, name, buf);
+}
+
+static double get_double (const char * section, const char * name)
+{
+    char * value = get_string (section, name);
+    double d = g_ascii_strtod (value, NULL);
+    g_free (value);
+    return d;
+}
+
+static void set_double (const char * section, const char * name, double value)
+{
+    char buf[G_ASCII_DTOSTR_BUF_SIZE];
+    g_ascii_dtostr (buf, sizeof buf, value);
+    set_string (section, name, buf);
+}
+
+static void show_error (const char * message)
+{
+    fprintf (stderr, "%s\n", message);
+}
+
+static const struct MiscAPI misc_api = {
+ .config_set_defaults = set_defaults,
+ .config_clear_section = clear_section,
+ .set_string = set_string,
+ .get_string = get_string,
+ .set_bool = set_bool,
+ .get_bool = get_bool,
+ .set_int = set_int,
+ .get_int = get_int,
+ .set_double = set_double,
+ .get_double = get_double,
+ .interface_show_error = show_error};
+
+static int verbose;
+
+static AudAPITable api_table = {
+ .misc_api = & misc_api,
+ .verbose = & verbose};
+
+static EffectPlugin * load_plugin (const char * path)
+{
+    GModule * module = g_module_open (path, G_MODULE_BIND_LAZY | G_MODULE_BIND_LOCAL);
+    if (! module)
+    {
+        fprintf (stderr, "Cannot load %s: %s\n", path, g_module_error ());
+        return NULL;
+    }
+
+    Plugin * (* get_info) (AudAPITable * table);
+    Plugin * header;
+
+    if (! g_module_symbol (module, "get_plugin_info", (void * *) & get_info) ||
+     ! (header = get_info (& api_table)) || header->magic != _AUD_PLUGIN_MAGIC)
+    {
+        fprintf (stderr, "%s is not an Audacious plugin.\n", path);
+        return NULL;
+    }
+
+    if (header->version < _AUD_PLUGIN_VERSION_MIN || header->version >
+     _AUD_PLUGIN_VERSION)
+    {
+        fprintf (stderr, "%s was built for a different version of Audacious.\n", path);
+        return NULL;
+    }
+
+    if (header->type != PLUGIN_TYPE_EFFECT)
+    {
+        fprintf (stderr, "%s is not an effect plugin.\n", path);
+        return NULL;
+    }
+
+    return (EffectPlugin *) header;
+}
+
+static float * read_input (int * frames)
+{
+    if (in_path)
+    {
+        SF_INFO info = {0};
+        SNDFILE * file = sf_open (in_path, SFM_READ, & info);
+
+        if (! file)
+        {
+            fprintf (stderr, "Cannot open %s: %s\n", in_path, sf_strerror (NULL));
+            return NULL;
+        }
+
+        float * data = g_new (float, info.channels * info.frames);
+        * frames = sf_readf_float (file, data, info.frames);
+        sf_close (file);
+
+        /* with no frames there would be nothing to time */
+        if (* frames < 1)
+        {
+            fprintf (stderr, "%s contains no audio.\n", in_path);
+            g_free (data);
+            return NULL;
+        }
+
+        channels = info.channels;
+        rate = info.samplerate;
+        return data;
+    }
+
+    /* A sine wave under white noise, different in each channel, so that
+     * effects which treat silence or correlated channels specially still have
+     * to do all their work. */
+    * frames = rate * seconds;
+    float * data = g_new (float, channels * * frames);
+    uint32_t seed = 1;
+
+    for (int f = 0; f < * frames; f ++)
+    {
+        for (int c = 0; c < channels; c ++)
+        {
+            seed = seed * 1664525 + 1013904223;
+            float noise = (int32_t) seed / 2147483648.0f;
+            float tone = sinf (2 * G_PI * 440 * (c + 1) * f / rate);
+
+            data[channels * f + c] = 0.25f * tone + 0.1f * noise;
+        }
+    }
+
+    return data;
+}
+
+static int64_t get_time (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, & ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int compare_times (const void * a, const void * b)
+{
+    int64_t x = * (const int64_t *) a, y = * (const int64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static double percentile (const int64_t * sorted, int count, double p)
+{
+    int i = (int) (p * (count - 1) + 0.5);
+    return sorted[i] / 1000.0;
+}
+
+static void usage (void)
+{
+    fprintf (stderr, "Usage: effect-bench [-i input] [-o output] [-r rate] "
+     "[-c channels] [-l seconds] [-b frames] [-p passes] [-s name=value] [-t] "
+     "plugin\n");
+    exit (EXIT_FAILURE);
+}
+
+int main (int argc, char * * argv)
+{
+    settings = g_array_new (FALSE, FALSE, sizeof (Setting));
+    overrides = g_array_new (FALSE, FALSE, sizeof (Setting));
+
+    int opt;
+    while ((opt = getopt (argc, argv, "i:o:r:c:l:b:p:s:t")) != -1)
+    {
+        switch (opt)
+        {
+        case 'i': in_path = optarg; break;
+        case 'o': out_path = optarg; break;
+        case 'r': rate = atoi (optarg); break;
+        case 'c': channels = atoi (optarg); break;
+        case 'l': seconds = atoi (optarg); break;
+        case 'b': block = atoi (optarg); break;
+        case 'p': passes = atoi (optarg); break;
+        case 't': tabular = TRUE; break;
+
+        case 's':
+        {
+            char * eq = strchr (optarg, '=');
+            if (! eq)
+                usage ();
+
+            Setting o = {NULL, g_strndup (optarg, eq - optarg), g_strdup (eq + 1)};
+            g_array_append_val (overrides, o);
+            break;
+        }
+
+        default:
+            usage ();
+        }
+    }
+
+    if (optind != argc - 1 || rate < 1 || channels < 1 || seconds < 1 ||
+     block < 1 || passes < 1)
+        usage ();
+
+    const char * path = argv[optind];
+    EffectPlugin * ep = load_plugin (path);
+    if (! ep)
+        return EXIT_FAILURE;
+
+    int frames;
+    float * input = read_input (& frames);
+    if (! input)
+        return EXIT_FAILURE;
+
+    if (ep->init && ! ep->init ())
+    {
+        fprintf (stderr, "%s failed to start.\n", path);
+        return EXIT_FAILURE;
+    }
+
+    int out_channels = channels, out_rate = rate;
+    ep->start (& out_channels, & out_rate);
+
+    SNDFILE * out_file = NULL;
+    if (out_path)
+    {
+        SF_INFO info = {.samplerate = out_rate, .channels = out_channels,
+         .format = SF_FORMAT_WAV | SF_FORMAT_FLOAT};
+
+        if (! (out_file = sf_open (out_path, SFM_WRITE, & info)))
+            fprintf (stderr, "Cannot create %s: %s\n", out_path, sf_strerror (NULL));
+    }
+
+    int blocks = (frames + block - 1) / block;
+    int calls = blocks * passes;
+    int64_t * times = g_new (int64_t, calls);
+    float * buffer = g_new (float, channels * block);
+    int64_t out_samples = 0;
+    int call = 0;
+
+    for (int pass = 0; pass < passes; pass ++)
+    {
+        if (pass && ep->flush)
+            ep->flush ();
+
+        for (int b = 0; b < blocks; b ++)
+        {
+            int length = MIN (block, frames - b * block);
+            memcpy (buffer, input + channels * block * b, sizeof (float) *
+             channels * length);
+
+            float * data = buffer;
+            int samples = channels * length;
+            bool_t last = (pass == passes - 1 && b == blocks - 1);
+
+            COUNT_ALLOCS (TRUE);
+            int64_t start = get_time ();
+
+            if (last)
+                ep->finish (& data, & samples);
+            else
+                ep->process (& data, & samples);
+
+            times[call ++] = get_time () - start;
+            COUNT_ALLOCS (FALSE);
+
+            out_samples += samples;
+            if (out_file && samples)
+                sf_writef_float (out_file, data, samples / out_channels);
+        }
+    }
+
+    if (out_file)
+        sf_close (out_file);
+
+    int delay = ep->adjust_delay ? ep->adjust_delay (0) : 0;
+
+    if (ep->cleanup)
+        ep->cleanup ();
+
+    int64_t total = 0;
+    for (int i = 0; i < calls; i ++)
+        total += times[i];
+
+    qsort (times, calls, sizeof (int64_t), compare_times);
+
+    int64_t in_samples = (int64_t) channels * frames * passes;
+    double secs = MAX (total, 1) / 1e9;
+    double audio = (double) frames * passes / rate;
+    double per_call = (double) allocs / calls;
+
+    if (tabular)
+    {
+        printf ("%s\t%d\t%d\t%d\t%d\t%" PRId64 "\t%" PRId64 "\t%.0f\t%.2f\t"
+         "%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%" PRId64 "\t%d\n", ep->name, channels,
+         rate, block, calls, in_samples, out_samples, in_samples / secs,
+         audio / secs, percentile (times, calls, 0.5), percentile (times,
+         calls, 0.9), percentile (times, calls, 0.99), percentile (times,
+         calls, 1), per_call, alloc_bytes, delay);
+    }
+    else
+    {
+        printf ("plugin:      %s (%s)\n", ep->name, path);
+        printf ("input:       %d ch, %d Hz, %d frames, %d-frame blocks, %d "
+         "pass(es)\n", channels, rate, frames, block, passes);
+        printf ("output:      %d ch, %d Hz, %" PRId64 " frames, %d ms latency\n",
+         out_channels, out_rate, out_samples / out_channels, delay);
+        printf ("throughput:  %.3g samples/s (%.1fx realtime)\n", in_samples /
+         secs, audio / secs);
+        printf ("per call:    p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us "
+         "(a block lasts %.1f us)\n", percentile (times, calls, 0.5),
+         percentile (times, calls, 0.9), percentile (times, calls, 0.99),
+         percentile (times, calls, 1), 1e6 * block / rate);
+
+        if (HAVE_ALLOC_COUNT)
+            printf ("allocations: %.2f per call, %" PRId64 " bytes in all\n",
+             per_call, alloc_bytes);
+    }
+
+    g_free (times);
+    g_free (buffer);
+    g_free (input);
+    return EXIT_SUCCESS;
+}
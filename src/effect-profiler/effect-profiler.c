@@ -0,0 +1,477 @@
+/*
+ * Effect Profiler Plugin for Audacious
+ * Copyright 2013 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/* Measures how much time each effect plugin takes.  The effect chain itself is
+ * run by Audacious, so instead of timing it from the inside, the profiler puts
+ * a wrapper in front of the start, process, finish and adjust_delay functions
+ * of every effect plugin and forwards each call to the original.  Because the
+ * functions get no context, each effect gets its own set of wrappers, told
+ * apart by a slot number. */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <gtk/gtk.h>
+
+#include <audacious/i18n.h>
+#include <audacious/misc.h>
+#include <audacious/plugin.h>
+#include <audacious/plugins.h>
+#include <libaudgui/list.h>
+
+#define MAX_EFFECTS 32
+#define REFRESH_DELAY 500 /* ms */
+
+enum {COL_NAME, COL_LOAD, COL_WORST, COL_CYCLES, COL_IN, COL_OUT, COL_LATENCY,
+ COLS};
+
+typedef struct {
+    PluginHandle * plugin;
+    EffectPlugin * header;
+
+    /* the functions the wrappers call through to */
+    void (* start) (int * channels, int * rate);
+    void (* process) (float * * data, int * samples);
+    void (* finish) (float * * data, int * samples);
+    int (* adjust_delay) (int delay);
+
+    /* Written by the audio thread and read by the main thread, one value at a
+     * time, so a snapshot may be a call out of date but never torn. */
+    int channels, rate;
+    int64_t calls, samples_in, samples_out;
+    int64_t time, worst, audio; /* ns */
+    int64_t cycles;
+    int latency; /* ms */
+} Slot;
+
+static Slot slots[MAX_EFFECTS];
+static int n_slots;
+
+static GtkWidget * list;
+static int refresh_source;
+
+/* the visible rows, as slot numbers */
+static int rows[MAX_EFFECTS];
+static int n_rows;
+
+#define GET(x) __atomic_load_n (& (x), __ATOMIC_RELAXED)
+#define SET(x, v) __atomic_store_n (& (x), (v), __ATOMIC_RELAXED)
+#define ADD(x, v) __atomic_fetch_add (& (x), (v), __ATOMIC_RELAXED)
+
+static int64_t get_time (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, & ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* The time stamp counter, where there is one; it counts CPU cycles (or a fixed
+ * rate close to them on newer processors) at almost no cost. */
+static uint64_t get_cycles (void)
+{
+#if defined (__x86_64__) || defined (__i386__)
+    return __builtin_ia32_rdtsc ();
+#else
+    return 0;
+#endif
+}
+
+static void timed_start (int n, int * channels, int * rate)
+{
+    Slot * s = & slots[n];
+
+    SET (s->channels, * channels);
+    SET (s->rate, * rate);
+
+    s->start (channels, rate);
+}
+
+static void timed_process (int n, float * * data, int * samples, bool_t finish)
+{
+    Slot * s = & slots[n];
+    int in = * samples;
+
+    int64_t time = get_time ();
+    uint64_t cycles = get_cycles ();
+
+    if (finish)
+        s->finish (data, samples);
+    else
+        s->process (data, samples);
+
+    cycles = get_cycles () - cycles;
+    time = get_time () - time;
+
+    int channels = GET (s->channels);
+    int rate = GET (s->rate);
+
+    ADD (s->calls, 1);
+    ADD (s->samples_in, in);
+    ADD (s->samples_out, * samples);
+    ADD (s->time, time);
+    ADD (s->cycles, cycles);
+
+    if (channels > 0 && rate > 0)
+        ADD (s->audio, (int64_t) in * 1000000000 / ((int64_t) channels * rate));
+
+    if (time > GET (s->worst))
+        SET (s->worst, time);
+}
+
+static int timed_delay (int n, int delay)
+{
+    Slot * s = & slots[n];
+    int out = s->adjust_delay (delay);
+
+    SET (s->latency, out - delay);
+    return out;
+}
+
+#define TRAMPOLINES(n) \
+static void start_##n (int * c, int * r) {timed_start (n, c, r);} \
+static void process_##n (float * * d, int * s) {timed_process (n, d, s, FALSE);} \
+static void finish_##n (float * * d, int * s) {timed_process (n, d, s, TRUE);} \
+static int delay_##n (int d) {return timed_delay (n, d);}
+
+TRAMPOLINES (0) TRAMPOLINES (1) TRAMPOLINES (2) TRAMPOLINES (3)
+TRAMPOLINES (4) TRAMPOLINES (5) TRAMPOLINES (6) TRAMPOLINES (7)
+TRAMPOLINES (8) TRAMPOLINES (9) TRAMPOLINES (10) TRAMPOLINES (11)
+TRAMPOLINES (12) TRAMPOLINES (13) TRAMPOLINES (14) TRAMPOLINES (15)
+TRAMPOLINES (16) TRAMPOLINES (17) TRAMPOLINES (18) TRAMPOLINES (19)
+TRAMPOLINES (20) TRAMPOLINES (21) TRAMPOLINES (22) TRAMPOLINES (23)
+TRAMPOLINES (24) TRAMPOLINES (25) TRAMPOLINES (26) TRAMPOLINES (27)
+TRAMPOLINES (28) TRAMPOLINES (29) TRAMPOLINES (30) TRAMPOLINES (31)
+
+#define WRAPPERS(n) {start_##n, process_##n, finish_##n, delay_##n}
+
+static const struct {
+    void (* start) (int * channels, int * rate);
+    void (* process) (float * * data, int * samples);
+    void (* finish) (float * * data, int * samples);
+    int (* adjust_delay) (int delay);
+} wrappers[MAX_EFFECTS] = {
+ WRAPPERS (0), WRAPPERS (1), WRAPPERS (2), WRAPPERS (3),
+ WRAPPERS (4), WRAPPERS (5), WRAPPERS (6), WRAPPERS (7),
+ WRAPPERS (8), WRAPPERS (9), WRAPPERS (10), WRAPPERS (11),
+ WRAPPERS (12), WRAPPERS (13), WRAPPERS (14), WRAPPERS (15),
+ WRAPPERS (16), WRAPPERS (17), WRAPPERS (18), WRAPPERS (19),
+ WRAPPERS (20), WRAPPERS (21), WRAPPERS (22), WRAPPERS (23),
+ WRAPPERS (24), WRAPPERS (25), WRAPPERS (26), WRAPPERS (27),
+ WRAPPERS (28), WRAPPERS (29), WRAPPERS (30), WRAPPERS (31)};
+
+/* The audio thread reads each function pointer afresh for every call, so a
+ * single pointer-sized store switches it over cleanly. */
+#define SWAP(x, v) __atomic_store_n (& (x), (v), __ATOMIC_RELEASE)
+
+static bool_t wrap_effect (PluginHandle * plugin, void * unused)
+{
+    if (n_slots == MAX_EFFECTS)
+        return FALSE;
+
+    EffectPlugin * header = aud_plugin_get_header (plugin);
+    if (! header || ! header->start || ! header->process || ! header->finish)
+        return TRUE;
+
+    int n = n_slots ++;
+    Slot * s = & slots[n];
+
+    memset (s, 0, sizeof (Slot));
+    s->plugin = plugin;
+    s->header = header;
+    s->start = header->start;
+    s->process = header->process;
+    s->finish = header->finish;
+    s->adjust_delay = header->adjust_delay;
+
+    SWAP (header->start, wrappers[n].start);
+    SWAP (header->process, wrappers[n].process);
+    SWAP (header->finish, wrappers[n].finish);
+
+    if (header->adjust_delay)
+        SWAP (header->adjust_delay, wrappers[n].adjust_delay);
+
+    return TRUE;
+}
+
+/* Puts the original functions back.  A call that is already inside one of the
+ * wrappers still finishes normally, since Audacious does not unload plugin
+ * modules until it exits. */
+static void unwrap_effects (void)
+{
+    for (int n = 0; n < n_slots; n ++)
+    {
+        Slot * s = & slots[n];
+
+        SWAP (s->header->start, s->start);
+        SWAP (s->header->process, s->process);
+        SWAP (s->header->finish, s->finish);
+
+        if (s->adjust_delay)
+            SWAP (s->header->adjust_delay, s->adjust_delay);
+    }
+
+    n_slots = 0;
+}
+
+static void reset_counters (void)
+{
+    for (int n = 0; n < n_slots; n ++)
+    {
+        Slot * s = & slots[n];
+
+        SET (s->calls, 0);
+        SET (s->samples_in, 0);
+        SET (s->samples_out, 0);
+        SET (s->time, 0);
+        SET (s->worst, 0);
+        SET (s->audio, 0);
+        SET (s->cycles, 0);
+    }
+}
+
+/* Time spent in the effect as a fraction of the duration of the audio it was
+ * given; anything near 1 cannot keep up. */
+static double realtime_ratio (Slot * s)
+{
+    int64_t audio = GET (s->audio);
+    return audio ? (double) GET (s->time) / audio : 0;
+}
+
+static double cycles_per_frame (Slot * s)
+{
+    int channels = GET (s->channels);
+    int64_t frames = channels ? GET (s->samples_in) / channels : 0;
+    return frames ? (double) GET (s->cycles) / frames : 0;
+}
+
+/* Writes the counters as tab-separated values, one line per effect, with the
+ * raw totals so that other tools can do their own arithmetic. */
+static void dump_profile (FILE * file)
+{
+    fprintf (file, "effect\tenabled\tcalls\tsamples_in\tsamples_out\ttime_ns\t"
+     "worst_ns\taudio_ns\tcycles\trealtime\tlatency_ms\tchannels\trate\n");
+
+    for (int n = 0; n < n_slots; n ++)
+    {
+        Slot * s = & slots[n];
+
+        fprintf (file, "%s\t%d\t%" PRId64 "\t%" PRId64 "\t%" PRId64 "\t%" PRId64
+         "\t%" PRId64 "\t%" PRId64 "\t%" PRId64 "\t%.6f\t%d\t%d\t%d\n",
+         aud_plugin_get_name (s->plugin), aud_plugin_get_enabled (s->plugin),
+         GET (s->calls), GET (s->samples_in), GET (s->samples_out),
+         GET (s->time), GET (s->worst), GET (s->audio), GET (s->cycles),
+         realtime_ratio (s), GET (s->latency), GET (s->channels),
+         GET (s->rate));
+    }
+}
+
+static void save_profile (void)
+{
+    char * path = g_build_filename (aud_get_path (AUD_PATH_USER_DIR),
+     "effect-profile", NULL);
+    FILE * file = fopen (path, "w");
+
+    if (file)
+    {
+        dump_profile (file);
+        fclose (file);
+    }
+    else
+        fprintf (stderr, "effect-profiler: Cannot write %s: %s.\n", path,
+         strerror (errno));
+
+    g_free (path);
+}
+
+static void get_value (void * user, int row, int column, GValue * value)
+{
+    g_return_if_fail (row >= 0 && row < n_rows);
+    Slot * s = & slots[rows[row]];
+
+    int channels = GET (s->channels);
+    char buf[32];
+
+    switch (column)
+    {
+    case COL_NAME:
+        g_value_set_string (value, aud_plugin_get_name (s->plugin));
+        return;
+    case COL_LOAD:
+        snprintf (buf, sizeof buf, "%.2f %%", 100 * realtime_ratio (s));
+        break;
+    case COL_WORST:
+        snprintf (buf, sizeof buf, "%.2f", GET (s->worst) / 1e6);
+        break;
+    case COL_CYCLES:
+        snprintf (buf, sizeof buf, "%.0f", cycles_per_frame (s));
+        break;
+    case COL_IN:
+        snprintf (buf, sizeof buf, "%" PRId64, channels ? GET (s->samples_in) /
+         channels : 0);
+        break;
+    case COL_OUT:
+        snprintf (buf, sizeof buf, "%" PRId64, channels ? GET (s->samples_out) /
+         channels : 0);
+        break;
+    case COL_LATENCY:
+        snprintf (buf, sizeof buf, "%d", GET (s->latency));
+        break;
+    default:
+        return;
+    }
+
+    g_value_set_string (value, buf);
+}
+
+/* nothing can be selected */
+static bool_t get_selected (void * user, int row)
+{
+    return FALSE;
+}
+
+static void set_selected (void * user, int row, bool_t selected)
+{
+}
+
+static void select_all (void * user, bool_t selected)
+{
+}
+
+static const AudguiListCallbacks callbacks = {
+ .get_value = get_value,
+ .get_selected = get_selected,
+ .set_selected = set_selected,
+ .select_all = select_all};
+
+/* Shows the effects which are enabled or have been used since the counters
+ * were last reset. */
+static bool_t refresh_cb (void * unused)
+{
+    int old_rows = n_rows;
+    n_rows = 0;
+
+    for (int n = 0; n < n_slots; n ++)
+    {
+        if (aud_plugin_get_enabled (slots[n].plugin) || GET (slots[n].calls))
+            rows[n_rows ++] = n;
+    }
+
+    if (n_rows != old_rows)
+    {
+        audgui_list_delete_rows (list, 0, old_rows);
+        audgui_list_insert_rows (list, 0, n_rows);
+    }
+    else if (n_rows)
+        audgui_list_update_rows (list, 0, n_rows);
+
+    return TRUE;
+}
+
+static void reset_cb (void)
+{
+    reset_counters ();
+    refresh_cb (NULL);
+}
+
+static void widget_destroyed (void)
+{
+    if (refresh_source)
+    {
+        g_source_remove (refresh_source);
+        refresh_source = 0;
+    }
+
+    list = NULL;
+    n_rows = 0;
+}
+
+static void * profiler_get_widget (void)
+{
+    GtkWidget * vbox = gtk_box_new (GTK_ORIENTATION_VERTICAL, 6);
+
+    GtkWidget * scrolled = gtk_scrolled_window_new (NULL, NULL);
+    gtk_scrolled_window_set_shadow_type ((GtkScrolledWindow *) scrolled, GTK_SHADOW_IN);
+    gtk_scrolled_window_set_policy ((GtkScrolledWindow *) scrolled,
+     GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+    gtk_box_pack_start ((GtkBox *) vbox, scrolled, TRUE, TRUE, 0);
+
+    list = audgui_list_new (& callbacks, NULL, 0);
+    audgui_list_add_column (list, _("Effect"), COL_NAME, G_TYPE_STRING, -1);
+    audgui_list_add_column (list, _("Load"), COL_LOAD, G_TYPE_STRING, 8);
+    audgui_list_add_column (list, _("Worst (ms)"), COL_WORST, G_TYPE_STRING, 8);
+    audgui_list_add_column (list, _("Cycles/frame"), COL_CYCLES, G_TYPE_STRING, 8);
+    audgui_list_add_column (list, _("Frames in"), COL_IN, G_TYPE_STRING, 10);
+    audgui_list_add_column (list, _("Frames out"), COL_OUT, G_TYPE_STRING, 10);
+    audgui_list_add_column (list, _("Latency (ms)"), COL_LATENCY, G_TYPE_STRING, 6);
+    gtk_container_add ((GtkContainer *) scrolled, list);
+
+    GtkWidget * hbox = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 6);
+    gtk_box_pack_end ((GtkBox *) vbox, hbox, FALSE, FALSE, 0);
+
+    GtkWidget * save = gtk_button_new_with_mnemonic (_("_Save"));
+    gtk_box_pack_end ((GtkBox *) hbox, save, FALSE, FALSE, 0);
+
+    GtkWidget * reset = gtk_button_new_with_mnemonic (_("_Reset"));
+    gtk_box_pack_end ((GtkBox *) hbox, reset, FALSE, FALSE, 0);
+
+    g_signal_connect (save, "clicked", (GCallback) save_profile, NULL);
+    g_signal_connect (reset, "clicked", (GCallback) reset_cb, NULL);
+    g_signal_connect (vbox, "destroy", (GCallback) widget_destroyed, NULL);
+
+    refresh_cb (NULL);
+    refresh_source = g_timeout_add (REFRESH_DELAY, (GSourceFunc) refresh_cb, NULL);
+
+    gtk_widget_show_all (vbox);
+    return vbox;
+}
+
+static bool_t profiler_init (void)
+{
+    aud_plugin_for_each (PLUGIN_TYPE_EFFECT, wrap_effect, NULL);
+    aud_plugin_menu_add (AUD_MENU_MAIN, save_profile, _("Save Effect Profile"),
+     NULL);
+    return TRUE;
+}
+
+static void profiler_cleanup (void)
+{
+    aud_plugin_menu_remove (AUD_MENU_MAIN, save_profile);
+    unwrap_effects ();
+}
+
+static const char profiler_about[] =
+ N_("Effect Profiler Plugin for Audacious\n"
+    "Copyright 2013 Audacious developers\n\n"
+    "Shows how much processor time each effect plugin uses, compared to the "
+    "duration of the audio it processes, along with the latency it adds.  "
+    "\"Save Effect Profile\" in the Services menu writes the same figures to "
+    "the file effect-profile in the Audacious settings folder.");
+
+AUD_GENERAL_PLUGIN
+(
+    .name = N_("Effect Profiler"),
+    .domain = PACKAGE,
+    .about_text = profiler_about,
+    .init = profiler_init,
+    .cleanup = profiler_cleanup,
+    .get_widget = profiler_get_widget
+)
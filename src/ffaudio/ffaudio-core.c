@@ -34,8 +34,12 @@
 #include <audacious/i18n.h>
 #include <audacious/debug.h>
 #include <audacious/audtag.h>
+#include <audacious/plugins.h>
 #include <libaudcore/audstrings.h>
 
+#include "dsp/dsp.h"
+#include "prefetch/prefetch.h"
+
 static pthread_mutex_t ctrl_mutex = PTHREAD_MUTEX_INITIALIZER;
 static gint64 seek_value = -1;
 static gboolean stop_flag = FALSE;
@@ -43,6 +47,11 @@ static gboolean stop_flag = FALSE;
 static pthread_mutex_t data_mutex = PTHREAD_MUTEX_INITIALIZER;
 static GHashTable * extension_dict = NULL;
 
+static void * prime_file (const gchar * filename);
+static void release_primed (void * primed);
+
+static Prefetcher prefetcher = PREFETCHER (prime_file, release_primed);
+
 /* str_unref() may be a macro */
 static void str_unref_cb (void * str)
 {
@@ -83,6 +92,8 @@ static gboolean ffaudio_init (void)
 static void
 ffaudio_cleanup(void)
 {
+    prefetch_cleanup (& prefetcher);
+
     if (extension_dict)
         g_hash_table_destroy (extension_dict);
 
@@ -398,6 +409,92 @@ static gboolean ffaudio_write_tag (const Tuple * tuple, VFSFile * file)
     return tag_tuple_write(tuple, file, TAG_TYPE_NONE);
 }
 
+/* An input file opened, with the decoder for its audio stream, ready to
+ * play. */
+typedef struct {
+    VFSFile * file; /* only if opened for prefetching */
+    AVFormatContext * ic;
+    AVCodecContext * c;
+    AVCodec * codec; /* only once opened */
+    gint stream_id;
+} Primed;
+
+static void release_primed (void * data)
+{
+    Primed * primed = data;
+
+    if (primed->codec)
+        avcodec_close (primed->c);
+    if (primed->ic)
+        close_input_file (primed->ic);
+    if (primed->file)
+        vfs_fclose (primed->file);
+
+    g_free (primed);
+}
+
+static gboolean prime_decoder (Primed * primed, const gchar * filename,
+ VFSFile * file)
+{
+    AVCodec * codec = NULL;
+
+    if (! (primed->ic = open_input_file (filename, file)))
+        return FALSE;
+
+    for (gint i = 0; i < primed->ic->nb_streams; i ++)
+    {
+        AVCodecContext * c = primed->ic->streams[i]->codec;
+
+        if (c->codec_type == AVMEDIA_TYPE_AUDIO)
+        {
+            avformat_find_stream_info (primed->ic, NULL);
+            codec = avcodec_find_decoder (c->codec_id);
+            primed->c = c;
+            primed->stream_id = i;
+            if (codec != NULL)
+                break;
+        }
+    }
+
+    if (codec == NULL)
+    {
+        fprintf (stderr, "ffaudio: No codec found for %s.\n", filename);
+        return FALSE;
+    }
+
+    AUDDBG("got codec %s for stream index %d, opening\n", codec->name, primed->stream_id);
+
+    if (avcodec_open2 (primed->c, codec, NULL) < 0)
+        return FALSE;
+
+    primed->codec = codec;
+    return TRUE;
+}
+
+static void * prime_file (const gchar * filename)
+{
+    Primed * primed = g_new0 (Primed, 1);
+
+    if (! (primed->file = vfs_fopen (filename, "r")) || vfs_is_streaming
+     (primed->file) || ! prime_decoder (primed, filename, primed->file))
+    {
+        release_primed (primed);
+        return NULL;
+    }
+
+    return primed;
+}
+
+/* Probing the format and finding the stream info can take many reads, which
+ * is more than enough to leave a gap between tracks, so the next track is
+ * primed while this one plays. */
+static void start_prefetch (const gchar * filename)
+{
+    extern InputPlugin _aud_plugin_self;
+    prefetch_next (& prefetcher, aud_plugin_by_header (& _aud_plugin_self),
+     filename);
+}
+
 static gboolean ffaudio_play (InputPlayback * playback, const gchar * filename,
  VFSFile * file, gint start_time, gint stop_time, gboolean pause)
 {
@@ -405,12 +502,9 @@ static gboolean ffaudio_play (InputPlayback * playback, const gchar * filename,
     if (! file)
         return FALSE;
 
-    AVCodec *codec = NULL;
-    AVCodecContext *c = NULL;
-    AVStream *s = NULL;
     AVPacket pkt = {.data = NULL};
-    gint i, stream_id, errcount;
-    gboolean codec_opened = FALSE;
+    AVFrame * frame = NULL;
+    gint errcount;
     gint out_fmt;
     gboolean planar;
     gboolean seekable;
@@ -419,37 +513,35 @@ static gboolean ffaudio_play (InputPlayback * playback, const gchar * filename,
     void *buf = NULL;
     gint bufsize = 0;
 
-    AVFormatContext * ic = open_input_file (filename, file);
-    if (! ic)
-        return FALSE;
+    Primed * primed = prefetch_take (& prefetcher, filename);
 
-    for (i = 0; i < ic->nb_streams; i++)
+    /* the file may have been changed since it was primed */
+    if (primed && vfs_fsize (primed->file) != vfs_fsize (file))
     {
-        s = ic->streams[i];
-        c = s->codec;
-        if (c->codec_type == AVMEDIA_TYPE_AUDIO)
-        {
-            avformat_find_stream_info (ic, NULL);
-            codec = avcodec_find_decoder(c->codec_id);
-            stream_id = i;
-            if (codec != NULL)
-                break;
-        }
+        release_primed (primed);
+        primed = NULL;
     }
 
-    if (codec == NULL)
+    if (primed)
+        AUDDBG ("Using prefetched decoder.\n");
+    else
     {
-        fprintf (stderr, "ffaudio: No codec found for %s.\n", filename);
-        goto error_exit;
+        primed = g_new0 (Primed, 1);
+
+        if (! prime_decoder (primed, filename, file))
+        {
+            release_primed (primed);
+            return FALSE;
+        }
     }
 
-    AUDDBG("got codec %s for stream index %d, opening\n", codec->name, stream_id);
+    AVFormatContext * ic = primed->ic;
+    AVCodecContext * c = primed->c;
 
-    if (avcodec_open2 (c, codec, NULL) < 0)
+    /* one frame for the whole stream, reset before each use */
+    if (! (frame = avcodec_alloc_frame ()))
         goto error_exit;
 
-    codec_opened = TRUE;
-
     switch (c->sample_fmt)
     {
         case AV_SAMPLE_FMT_U8: out_fmt = FMT_U8; planar = FALSE; break;
@@ -491,10 +583,12 @@ static gboolean ffaudio_play (InputPlayback * playback, const gchar * filename,
     seek_value = (start_time > 0) ? start_time : -1;
     playback->set_pb_ready(playback);
     errcount = 0;
-    seekable = ffaudio_codec_is_seekable(codec);
+    seekable = ffaudio_codec_is_seekable(primed->codec);
 
     pthread_mutex_unlock (& ctrl_mutex);
 
+    start_prefetch (filename);
+
     while (!stop_flag && (stop_time < 0 ||
      playback->output->written_time () < stop_time))
     {
@@ -537,7 +631,7 @@ static gboolean ffaudio_play (InputPlayback * playback, const gchar * filename,
             errcount = 0;
 
         /* Ignore any other substreams */
-        if (pkt.stream_index != stream_id)
+        if (pkt.stream_index != primed->stream_id)
         {
             av_free_packet(&pkt);
             continue;
@@ -561,7 +655,8 @@ static gboolean ffaudio_play (InputPlayback * playback, const gchar * filename,
             }
             pthread_mutex_unlock (& ctrl_mutex);
 
-            AVFrame * frame = avcodec_alloc_frame ();
+            avcodec_get_frame_defaults (frame);
+
             int decoded = 0;
             int len = avcodec_decode_audio4 (c, frame, & decoded, & tmp);
 
@@ -587,14 +682,12 @@ static gboolean ffaudio_play (InputPlayback * playback, const gchar * filename,
                     bufsize = size;
                 }
 
-                audio_interlace ((const void * *) frame->data, out_fmt,
-                 c->channels, buf, frame->nb_samples);
+                dsp_interleave ((const void * const *) frame->extended_data,
+                 FMT_SIZEOF (out_fmt), c->channels, buf, frame->nb_samples);
                 playback->output->write_audio (buf, size);
             }
             else
                 playback->output->write_audio (frame->data[0], size);
-
-            av_free (frame);
         }
 
         if (pkt.data)
@@ -606,11 +699,10 @@ error_exit:
 
     if (pkt.data)
         av_free_packet(&pkt);
-    if (codec_opened)
-        avcodec_close(c);
-    if (ic != NULL)
-        close_input_file(ic);
 
+    release_primed (primed);
+
+    av_free (frame);
     free (buf);
 
     return ! error;
@@ -20,10 +20,52 @@
 #include <assert.h>
 #include <stdio.h>
 
+#include <audacious/misc.h>
+
+#include "dsp/dsp.h"
 #include "ladspa.h"
 #include "plugin.h"
 
+/* The chain works on planar audio: each block is split into one buffer per
+ * channel on the way in and interleaved again on the way out, no matter how
+ * many plugins there are.  Each channel has two buffers.  A plugin which can
+ * work in place reads and writes the current one; otherwise it writes to the
+ * spare one, which then becomes the current one for the next plugin. */
+
 static int ladspa_channels, ladspa_rate;
+static float * chain_mem;
+static float * * current, * * spare;
+
+/* If enabled, the instances of each plugin (one per channel, or per channel
+ * pair, and so on) run side by side on a pool of threads.  They share no state,
+ * and each plugin still waits for the one before it to finish the block. */
+static DSPWorkers * workers;
+
+typedef struct {
+    LoadedPlugin * loaded;
+    int frames;
+} InstanceJob;
+
+/* The audio thread never waits for the main thread.  Whenever the list of
+ * enabled plugins changes, the main thread publishes a new snapshot of it,
+ * which the audio thread picks up at the start of its next block.  Plugins left
+ * out of the new snapshot are shut down by the audio thread at that point, and
+ * the main thread frees them once it sees that the audio thread has moved on.
+ * Control values are written by the main thread at any time and copied by the
+ * audio thread between blocks, so they never change while a plugin runs.
+ *
+ * The audio thread holds audio_mutex while it works on a block.  The main
+ * thread takes it only when it must be sure that no plugin code is running,
+ * that is, before unloading modules. */
+
+static pthread_mutex_t audio_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static Chain * pending_chain; /* handed from the main thread to the audio thread */
+static Chain * active_chain; /* audio thread only */
+static int adopted_serial; /* written by the audio thread */
+
+static int chain_serial; /* main thread only */
+static Index * removed; /* (LoadedPlugin *), main thread only */
 
 static void start_plugin (LoadedPlugin * loaded)
 {
@@ -53,8 +95,8 @@ static void start_plugin (LoadedPlugin * loaded)
     int instances = ladspa_channels / ports;
 
     loaded->instances = index_new ();
-    loaded->in_bufs = g_malloc (sizeof (float *) * ladspa_channels);
-    loaded->out_bufs = g_malloc (sizeof (float *) * ladspa_channels);
+    loaded->in_bufs = g_malloc0 (sizeof (float *) * ladspa_channels);
+    loaded->out_bufs = g_malloc0 (sizeof (float *) * ladspa_channels);
 
     for (int i = 0; i < instances; i ++)
     {
@@ -65,77 +107,137 @@ static void start_plugin (LoadedPlugin * loaded)
         for (int c = 0; c < controls; c ++)
         {
             ControlData * control = index_get (plugin->controls, c);
-            desc->connect_port (handle, control->port, & loaded->values[c]);
+            desc->connect_port (handle, control->port, & loaded->run_values[c]);
         }
 
-        for (int p = 0; p < ports; p ++)
-        {
-            int channel = ports * i + p;
-
-            float * in = g_malloc (sizeof (float) * LADSPA_BUFLEN);
-            loaded->in_bufs[channel] = in;
-            int in_port = g_array_index (plugin->in_ports, int, p);
-            desc->connect_port (handle, in_port, in);
-
-            float * out = g_malloc (sizeof (float) * LADSPA_BUFLEN);
-            loaded->out_bufs[channel] = out;
-            int out_port = g_array_index (plugin->out_ports, int, p);
-            desc->connect_port (handle, out_port, out);
-        }
+        /* the audio ports are connected in run_plugin() */
 
         if (desc->activate)
             desc->activate (handle);
     }
 }
 
-static void run_plugin (LoadedPlugin * loaded, float * data, int samples)
+static void run_instance (void * data, int i)
+{
+    InstanceJob * job = data;
+    LoadedPlugin * loaded = job->loaded;
+
+    loaded->plugin->desc->run (index_get (loaded->instances, i), job->frames);
+}
+
+/* Runs one plugin on the current buffers.  The ports are only connected again
+ * when the buffers they should use have changed since the last block. */
+static void run_plugin (LoadedPlugin * loaded, int frames)
 {
     if (! loaded->instances)
         return;
 
     PluginData * plugin = loaded->plugin;
     const LADSPA_Descriptor * desc = plugin->desc;
+    int in_place = ! LADSPA_IS_INPLACE_BROKEN (desc->Properties);
 
     int ports = plugin->in_ports->len;
     int instances = index_count (loaded->instances);
     assert (ports * instances == ladspa_channels);
 
+    for (int i = 0; i < instances; i ++)
+    {
+        LADSPA_Handle * handle = index_get (loaded->instances, i);
+
+        for (int p = 0; p < ports; p ++)
+        {
+            int channel = ports * i + p;
+            float * in = current[channel];
+            float * out = in_place ? in : spare[channel];
+
+            if (loaded->in_bufs[channel] != in)
+            {
+                desc->connect_port (handle, g_array_index (plugin->in_ports, int, p), in);
+                loaded->in_bufs[channel] = in;
+            }
+
+            if (loaded->out_bufs[channel] != out)
+            {
+                desc->connect_port (handle, g_array_index (plugin->out_ports, int, p), out);
+                loaded->out_bufs[channel] = out;
+            }
+        }
+    }
+
+    if (workers)
+    {
+        InstanceJob job = {loaded, frames};
+        dsp_workers_run (workers, run_instance, & job, instances);
+    }
+    else
+    {
+        for (int i = 0; i < instances; i ++)
+            desc->run (index_get (loaded->instances, i), frames);
+    }
+
+    if (! in_place)
+    {
+        float * * swap = current;
+        current = spare;
+        spare = swap;
+    }
+}
+
+/* Runs the whole chain on a block of interleaved audio. */
+static void run_chain (float * data, int samples)
+{
+    if (! active_chain)
+        return;
+
+    int count = active_chain->count;
+    int usable = 0;
+
+    for (int i = 0; i < count; i ++)
+    {
+        LoadedPlugin * loaded = active_chain->plugins[i];
+        start_plugin (loaded);
+
+        int controls = index_count (loaded->plugin->controls);
+        for (int c = 0; c < controls; c ++)
+            __atomic_load (& loaded->values[c], & loaded->run_values[c], __ATOMIC_RELAXED);
+
+        if (loaded->instances)
+            usable ++;
+    }
+
+    if (! usable)
+        return;
+
     while (samples / ladspa_channels > 0)
     {
         int frames = MIN (samples / ladspa_channels, LADSPA_BUFLEN);
 
-        for (int i = 0; i < instances; i ++)
+        for (int c = 0; c < ladspa_channels; c ++)
         {
-            LADSPA_Handle * handle = index_get (loaded->instances, i);
+            float * get = data + c;
+            float * in = current[c];
+            float * in_end = in + frames;
 
-            for (int p = 0; p < ports; p ++)
+            while (in < in_end)
             {
-                int channel = ports * i + p;
-                float * get = data + channel;
-                float * in = loaded->in_bufs[channel];
-                float * in_end = in + frames;
-
-                while (in < in_end)
-                {
-                    * in ++ = * get;
-                    get += ladspa_channels;
-                }
+                * in ++ = * get;
+                get += ladspa_channels;
             }
+        }
+
+        for (int i = 0; i < count; i ++)
+            run_plugin (active_chain->plugins[i], frames);
 
-            desc->run (handle, frames);
+        for (int c = 0; c < ladspa_channels; c ++)
+        {
+            float * set = data + c;
+            float * out = current[c];
+            float * out_end = out + frames;
 
-            for (int p = 0; p < ports; p ++)
+            while (out < out_end)
             {
-                int channel = ports * i + p;
-                float * set = data + channel;
-                float * out = loaded->out_bufs[channel];
-                float * out_end = out + frames;
-
-                while (out < out_end)
-                {
-                    * set = * out ++;
-                    set += ladspa_channels;
-                }
+                * set = * out ++;
+                set += ladspa_channels;
             }
         }
 
@@ -164,7 +266,7 @@ static void flush_plugin (LoadedPlugin * loaded)
     }
 }
 
-void shutdown_plugin_locked (LoadedPlugin * loaded)
+static void shutdown_plugin (LoadedPlugin * loaded)
 {
     loaded->active = 0;
 
@@ -185,12 +287,6 @@ void shutdown_plugin_locked (LoadedPlugin * loaded)
         desc->cleanup (handle);
     }
 
-    for (int channel = 0; channel < ladspa_channels; channel ++)
-    {
-        g_free (loaded->in_bufs[channel]);
-        g_free (loaded->out_bufs[channel]);
-    }
-
     index_free (loaded->instances);
     loaded->instances = NULL;
     g_free (loaded->in_bufs);
@@ -199,64 +295,210 @@ void shutdown_plugin_locked (LoadedPlugin * loaded)
     loaded->out_bufs = NULL;
 }
 
-void ladspa_start (int * channels, int * rate)
+static void free_planes (void)
 {
-    pthread_mutex_lock (& mutex);
-
-    int count = index_count (loadeds);
-    for (int i = 0; i < count; i ++)
+    g_free (chain_mem);
+    chain_mem = NULL;
+    g_free (current);
+    current = NULL;
+    g_free (spare);
+    spare = NULL;
+
+    if (workers)
     {
-        LoadedPlugin * loaded = index_get (loadeds, i);
-        shutdown_plugin_locked (loaded);
+        dsp_workers_free (workers);
+        workers = NULL;
     }
+}
 
-    ladspa_channels = * channels;
-    ladspa_rate = * rate;
+static int chain_has (Chain * chain, LoadedPlugin * loaded)
+{
+    for (int i = 0; i < chain->count; i ++)
+    {
+        if (chain->plugins[i] == loaded)
+            return 1;
+    }
 
-    pthread_mutex_unlock (& mutex);
+    return 0;
 }
 
-void ladspa_process (float * * data, int * samples)
+/* Switches to the latest snapshot of the chain, if there is a new one.  Called
+ * with audio_mutex held. */
+static void adopt_chain (void)
 {
-    pthread_mutex_lock (& mutex);
+    Chain * next = __atomic_exchange_n (& pending_chain, NULL, __ATOMIC_ACQ_REL);
 
-    int count = index_count (loadeds);
-    for (int i = 0; i < count; i ++)
+    if (! next)
+        return;
+
+    if (active_chain)
     {
-        LoadedPlugin * loaded = index_get (loadeds, i);
-        start_plugin (loaded);
-        run_plugin (loaded, * data, * samples);
+        for (int i = 0; i < active_chain->count; i ++)
+        {
+            if (! chain_has (next, active_chain->plugins[i]))
+                shutdown_plugin (active_chain->plugins[i]);
+        }
+
+        g_free (active_chain);
     }
 
-    pthread_mutex_unlock (& mutex);
+    active_chain = next;
+    __atomic_store_n (& adopted_serial, next->serial, __ATOMIC_RELEASE);
 }
 
-void ladspa_flush (void)
+static void free_removed_locked (void)
 {
-    pthread_mutex_lock (& mutex);
+    if (! removed)
+        return;
 
+    int adopted = __atomic_load_n (& adopted_serial, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i < index_count (removed); )
+    {
+        LoadedPlugin * loaded = index_get (removed, i);
+
+        if (loaded->removed_serial && loaded->removed_serial <= adopted)
+        {
+            g_free (loaded->values);
+            g_free (loaded->run_values);
+            g_slice_free (LoadedPlugin, loaded);
+            index_delete (removed, i, 1);
+        }
+        else
+            i ++;
+    }
+}
+
+void publish_chain_locked (void)
+{
     int count = index_count (loadeds);
+    Chain * chain = g_malloc (sizeof (Chain) + sizeof (LoadedPlugin *) * count);
+
+    chain->serial = ++ chain_serial;
+    chain->count = count;
+
     for (int i = 0; i < count; i ++)
+        chain->plugins[i] = index_get (loadeds, i);
+
+    /* plugins removed since the last snapshot are gone as of this one */
+    for (int i = 0; removed && i < index_count (removed); i ++)
     {
-        LoadedPlugin * loaded = index_get (loadeds, i);
-        flush_plugin (loaded);
+        LoadedPlugin * loaded = index_get (removed, i);
+        if (! loaded->removed_serial)
+            loaded->removed_serial = chain->serial;
     }
 
-    pthread_mutex_unlock (& mutex);
+    /* a snapshot which the audio thread never picked up can go right away */
+    g_free (__atomic_exchange_n (& pending_chain, chain, __ATOMIC_ACQ_REL));
+
+    free_removed_locked ();
 }
 
-void ladspa_finish (float * * data, int * samples)
+void retire_plugin_locked (LoadedPlugin * loaded)
 {
-    pthread_mutex_lock (& mutex);
+    if (! removed)
+        removed = index_new ();
 
-    int count = index_count (loadeds);
-    for (int i = 0; i < count; i ++)
+    loaded->removed_serial = 0;
+    index_append (removed, loaded);
+}
+
+void sync_chain_locked (void)
+{
+    publish_chain_locked ();
+
+    pthread_mutex_lock (& audio_mutex);
+    adopt_chain ();
+    pthread_mutex_unlock (& audio_mutex);
+
+    free_removed_locked ();
+}
+
+void free_chain_locked (void)
+{
+    sync_chain_locked ();
+
+    pthread_mutex_lock (& audio_mutex);
+
+    g_free (active_chain);
+    active_chain = NULL;
+
+    free_planes ();
+
+    pthread_mutex_unlock (& audio_mutex);
+
+    if (removed)
     {
-        LoadedPlugin * loaded = index_get (loadeds, i);
-        start_plugin (loaded);
-        run_plugin (loaded, * data, * samples);
-        shutdown_plugin_locked (loaded);
+        index_free (removed);
+        removed = NULL;
     }
+}
+
+
+void ladspa_start (int * channels, int * rate)
+{
+    pthread_mutex_lock (& audio_mutex);
+
+    adopt_chain ();
+
+    for (int i = 0; active_chain && i < active_chain->count; i ++)
+        shutdown_plugin (active_chain->plugins[i]);
+
+    ladspa_channels = * channels;
+    ladspa_rate = * rate;
+
+    free_planes ();
+
+    chain_mem = g_malloc (sizeof (float) * 2 * ladspa_channels * LADSPA_BUFLEN);
+    current = g_malloc (sizeof (float *) * ladspa_channels);
+    spare = g_malloc (sizeof (float *) * ladspa_channels);
+
+    for (int c = 0; c < ladspa_channels; c ++)
+    {
+        current[c] = chain_mem + LADSPA_BUFLEN * c;
+        spare[c] = chain_mem + LADSPA_BUFLEN * (ladspa_channels + c);
+    }
+
+    int threads = MIN (aud_get_int ("ladspa", "threads"), LADSPA_MAX_THREADS);
+    threads = MIN (threads, ladspa_channels);
+
+    if (threads > 1)
+        workers = dsp_workers_new (threads);
+
+    pthread_mutex_unlock (& audio_mutex);
+}
+
+void ladspa_process (float * * data, int * samples)
+{
+    pthread_mutex_lock (& audio_mutex);
+
+    adopt_chain ();
+    run_chain (* data, * samples);
+
+    pthread_mutex_unlock (& audio_mutex);
+}
+
+void ladspa_flush (void)
+{
+    pthread_mutex_lock (& audio_mutex);
+
+    adopt_chain ();
+
+    for (int i = 0; active_chain && i < active_chain->count; i ++)
+        flush_plugin (active_chain->plugins[i]);
+
+    pthread_mutex_unlock (& audio_mutex);
+}
+
+void ladspa_finish (float * * data, int * samples)
+{
+    pthread_mutex_lock (& audio_mutex);
+
+    adopt_chain ();
+    run_chain (* data, * samples);
+
+    for (int i = 0; active_chain && i < active_chain->count; i ++)
+        shutdown_plugin (active_chain->plugins[i]);
 
-    pthread_mutex_unlock (& mutex);
+    pthread_mutex_unlock (& audio_mutex);
 }
@@ -58,8 +58,6 @@ static void select_all (void * user, int selected)
 
 static void shift_rows (void * user, int row, int before)
 {
-    pthread_mutex_lock (& mutex);
-
     int rows = index_count (loadeds);
     g_return_if_fail (row >= 0 && row < rows);
     g_return_if_fail (before >= 0 && before <= rows);
@@ -67,6 +65,8 @@ static void shift_rows (void * user, int row, int before)
     if (before == row)
         return;
 
+    pthread_mutex_lock (& mutex);
+
     Index * move = index_new ();
     Index * others = index_new ();
 
@@ -107,6 +107,8 @@ static void shift_rows (void * user, int row, int before)
     index_copy_set (move, 0, loadeds, begin, end - begin);
     index_free (move);
 
+    publish_chain_locked ();
+
     pthread_mutex_unlock (& mutex);
 
     if (loaded_list)
@@ -37,6 +37,7 @@
 
 static const gchar * const ladspa_defaults[] = {
  "plugin_count", "0",
+ "threads", "1",
  NULL};
 
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -255,6 +256,7 @@ LoadedPlugin * enable_plugin_locked (PluginData * plugin)
 
     int count = index_count (plugin->controls);
     loaded->values = g_malloc (sizeof (float) * count);
+    loaded->run_values = g_malloc (sizeof (float) * count);
 
     for (int i = 0; i < count; i ++)
     {
@@ -268,6 +270,7 @@ LoadedPlugin * enable_plugin_locked (PluginData * plugin)
     loaded->out_bufs = NULL;
 
     loaded->settings_win = NULL;
+    loaded->removed_serial = 0;
 
     index_append (loadeds, loaded);
     return loaded;
@@ -281,11 +284,8 @@ void disable_plugin_locked (int i)
     if (loaded->settings_win)
         gtk_widget_destroy (loaded->settings_win);
 
-    shutdown_plugin_locked (loaded);
-
-    g_free (loaded->values);
-    g_slice_free (LoadedPlugin, loaded);
     index_delete (loadeds, i, 1);
+    retire_plugin_locked (loaded);
 }
 
 static PluginData * find_plugin (const char * path, const char * label)
@@ -374,6 +374,7 @@ static int init (void)
 
     open_modules ();
     load_enabled_from_config ();
+    publish_chain_locked ();
 
     pthread_mutex_unlock (& mutex);
     return 1;
@@ -386,9 +387,13 @@ static void cleanup (void)
 
     pthread_mutex_lock (& mutex);
 
+    int threads = aud_get_int ("ladspa", "threads");
+
     aud_config_clear_section ("ladspa");
     aud_set_string ("ladspa", "module_path", module_path);
+    aud_set_int ("ladspa", "threads", threads);
     save_enabled_to_config ();
+    free_chain_locked ();
     close_modules ();
 
     index_free (modules);
@@ -409,6 +414,7 @@ static void set_module_path (GtkEntry * entry)
     pthread_mutex_lock (& mutex);
 
     save_enabled_to_config ();
+    sync_chain_locked ();
     close_modules ();
 
     g_free (module_path);
@@ -416,6 +422,7 @@ static void set_module_path (GtkEntry * entry)
 
     open_modules ();
     load_enabled_from_config ();
+    publish_chain_locked ();
 
     pthread_mutex_unlock (& mutex);
 
@@ -437,6 +444,8 @@ static void enable_selected (void)
             enable_plugin_locked (plugin);
     }
 
+    publish_chain_locked ();
+
     pthread_mutex_unlock (& mutex);
 
     if (loaded_list)
@@ -459,24 +468,26 @@ static void disable_selected (void)
         }
     }
 
+    publish_chain_locked ();
+
     pthread_mutex_unlock (& mutex);
 
     if (loaded_list)
         update_loaded_list (loaded_list);
 }
 
+/* The audio thread picks up the new value at the start of its next block. */
+
 static void control_toggled (GtkToggleButton * toggle, float * value)
 {
-    pthread_mutex_lock (& mutex);
-    * value = gtk_toggle_button_get_active (toggle) ? 1 : 0;
-    pthread_mutex_unlock (& mutex);
+    float set = gtk_toggle_button_get_active (toggle) ? 1 : 0;
+    __atomic_store (value, & set, __ATOMIC_RELAXED);
 }
 
 static void control_changed (GtkSpinButton * spin, float * value)
 {
-    pthread_mutex_lock (& mutex);
-    * value = gtk_spin_button_get_value (spin);
-    pthread_mutex_unlock (& mutex);
+    float set = gtk_spin_button_get_value (spin);
+    __atomic_store (value, & set, __ATOMIC_RELAXED);
 }
 
 static void configure_plugin (LoadedPlugin * loaded)
@@ -550,6 +561,11 @@ static void configure_selected (void)
     pthread_mutex_unlock (& mutex);
 }
 
+static void set_threads (GtkSpinButton * spin)
+{
+    aud_set_int ("ladspa", "threads", gtk_spin_button_get_value_as_int (spin));
+}
+
 static void configure (void)
 {
     if (config_win)
@@ -582,6 +598,25 @@ static void configure (void)
     GtkWidget * entry = gtk_entry_new ();
     gtk_box_pack_start ((GtkBox *) hbox, entry, 1, 1, 0);
 
+    hbox = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 6);
+    gtk_box_pack_start ((GtkBox *) vbox, hbox, 0, 0, 0);
+
+    label = gtk_label_new (_("Threads for multichannel audio:"));
+    gtk_box_pack_start ((GtkBox *) hbox, label, 0, 0, 0);
+
+    GtkWidget * threads_spin = gtk_spin_button_new_with_range (1,
+     LADSPA_MAX_THREADS, 1);
+    gtk_spin_button_set_value ((GtkSpinButton *) threads_spin, aud_get_int ("ladspa", "threads"));
+    gtk_box_pack_start ((GtkBox *) hbox, threads_spin, 0, 0, 0);
+
+    label = gtk_label_new (0);
+    gtk_label_set_markup ((GtkLabel *) label,
+     _("<small>Mono plugins are run on several channels at once.\n"
+     "Takes effect at the start of the next song.</small>"));
+    gtk_misc_set_padding ((GtkMisc *) label, 12, 6);
+    gtk_misc_set_alignment ((GtkMisc *) label, 0, 0);
+    gtk_box_pack_start ((GtkBox *) vbox, label, 0, 0, 0);
+
     hbox = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 6);
     gtk_box_pack_start ((GtkBox *) vbox, hbox, 1, 1, 0);
 
@@ -632,6 +667,7 @@ static void configure (void)
     g_signal_connect (config_win, "response", (GCallback) gtk_widget_destroy, NULL);
     g_signal_connect (config_win, "destroy", (GCallback) gtk_widget_destroyed, & config_win);
     g_signal_connect (entry, "activate", (GCallback) set_module_path, NULL);
+    g_signal_connect (threads_spin, "value-changed", (GCallback) set_threads, NULL);
     g_signal_connect (plugin_list, "destroy", (GCallback) gtk_widget_destroyed, & plugin_list);
     g_signal_connect (enable_button, "clicked", (GCallback) enable_selected, NULL);
     g_signal_connect (loaded_list, "destroy", (GCallback) gtk_widget_destroyed, & loaded_list);
@@ -27,6 +27,7 @@
 #include "ladspa.h"
 
 #define LADSPA_BUFLEN 1024
+#define LADSPA_MAX_THREADS 8
 
 typedef struct {
     int port;
@@ -45,19 +46,27 @@ typedef struct {
 
 typedef struct {
     PluginData * plugin;
-    float * values;
+    float * values; /* set by the main thread, atomically */
+    float * run_values; /* copy used by the audio thread */
     char selected;
     char active;
     Index * instances; /* (LADSPA_Handle) */
-    float * * in_bufs, * * out_bufs; /* (float *) */
+    float * * in_bufs, * * out_bufs; /* buffers connected to each channel */
     GtkWidget * settings_win;
+    int removed_serial; /* first chain without this plugin, or 0 */
 } LoadedPlugin;
 
+/* A snapshot of the enabled plugins, in order, for the audio thread. */
+typedef struct {
+    int serial, count;
+    LoadedPlugin * plugins[];
+} Chain;
+
 /* plugin.c */
 
 /* The mutex needs to be locked when the main thread is writing to the data
- * structures below (but not when it is only reading from them) and when the
- * audio thread is reading from them. */
+ * structures below (but not when it is only reading from them).  The audio
+ * thread does not use them; it works from snapshots published by effect.c. */
 
 extern pthread_mutex_t mutex;
 extern char * module_path;
@@ -75,7 +84,19 @@ void disable_plugin_locked (int i);
 
 /* effect.c */
 
-void shutdown_plugin_locked (LoadedPlugin * loaded);
+/* Hands the current list of enabled plugins to the audio thread.  Call after
+ * any change to it. */
+void publish_chain_locked (void);
+
+/* Takes a plugin which has been removed from the list; it is freed once the
+ * audio thread is done with it. */
+void retire_plugin_locked (LoadedPlugin * loaded);
+
+/* Publishes the list and waits until the audio thread has switched to it, so
+ * that no removed plugin is still running.  Needed before closing modules. */
+void sync_chain_locked (void);
+
+void free_chain_locked (void);
 
 void ladspa_start (gint * channels, gint * rate);
 void ladspa_process (gfloat * * data, gint * samples);
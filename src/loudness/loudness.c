@@ -0,0 +1,939 @@
+/*
+ * Loudness Scanner Plugin for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include <audacious/i18n.h>
+#include <audacious/misc.h>
+#include <audacious/playlist.h>
+#include <audacious/plugin.h>
+#include <audacious/plugins.h>
+#include <audacious/preferences.h>
+#include <libaudcore/audstrings.h>
+#include <libaudcore/index.h>
+
+#include "meter.h"
+
+/* Scans songs in the background, measures their loudness with an EBU R128
+ * meter, and writes ReplayGain information (relative to -18 LUFS, as in
+ * ReplayGain 2.0) into their tags.
+ *
+ * The songs are decoded by the usual input plugins, called directly from a pool
+ * of worker threads with an InputPlayback of our own whose output goes to the
+ * meter.  Most input plugins keep their stop and seek flags in static
+ * variables, so a scan by such a plugin would stop or seek the player's song
+ * as well, and playback can begin at any time.  Only the plugins listed in
+ * shared_decoders[], which keep their state in the InputPlayback instead
+ * (through set_data), are used; they can decode any number of songs alongside
+ * the player.  Songs needing any other plugin are skipped.
+ *
+ * Results are also saved to a file in the user's config directory as soon as
+ * each song is done, so an interrupted scan picks up where it left off, and
+ * songs whose tags cannot be written keep their results.  Each result is kept
+ * with the size and modification time of the file, and is measured again if
+ * either changes. */
+
+#define MAX_THREADS 32
+#define REFERENCE -18 /* LUFS */
+#define GAIN_UNIT 100
+#define PEAK_UNIT 1000000
+#define UPDATE_DELAY 250 /* ms */
+#define WAIT_DELAY 1000 /* ms */
+
+typedef struct {
+    float loudness, peak;
+    int blocks;
+    int64_t size, mtime; /* of the file when it was scanned; 0 if unknown */
+} Result;
+
+typedef struct album Album;
+
+typedef struct {
+    char * filename, * key;
+    int start, stop, length; /* ms; stop and length are -1 if unknown */
+    Album * album;
+    PluginHandle * decoder;
+    bool_t scanned;
+    Result result;
+} Track;
+
+struct album {
+    Index * tracks;
+    int unfinished;
+};
+
+typedef struct {
+    InputPlayback playback; /* must come first */
+    InputPlugin * header;
+    Track * track;
+    void * data;
+    bool_t ready, stopped, failed;
+    int format, rate, channels, base_time;
+    int64_t frames;
+    Meter * meter;
+    float * buffer;
+    int buffer_size;
+} Scan;
+
+/* basenames of the input plugins that keep their state through set_data */
+static const char * const shared_decoders[] = {"madplug"};
+
+static const char * const loudness_defaults[] = {
+ "threads", "0",
+ NULL};
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+static pthread_t threads[MAX_THREADS];
+static int n_threads, working;
+static bool_t stopping;
+
+static Index * queue; /* tracks waiting to be scanned */
+static Index * finished_albums; /* albums whose tags can be written */
+static Index * rescans; /* pooled filenames for the main thread */
+static Index * scans; /* running scans */
+
+static GHashTable * cache; /* key -> Result */
+static GHashTable * queued; /* key -> Track, for every track not yet freed */
+static FILE * cache_file;
+
+static int update_source;
+
+static __thread Scan * current_scan;
+
+/* ---- results file ---- */
+
+static char * make_key (const char * filename, int start)
+{
+    return g_strdup_printf ("%d %s", start, filename);
+}
+
+static char * cache_path (void)
+{
+    return g_build_filename (aud_get_path (AUD_PATH_USER_DIR), "loudness", NULL);
+}
+
+/* Only local files can be checked for changes. */
+static void get_file_key (const char * filename, int64_t * size, int64_t * mtime)
+{
+    char * local = uri_to_filename (filename);
+    struct stat st;
+
+    if (local && ! stat (local, & st))
+    {
+        * size = st.st_size;
+        * mtime = st.st_mtime;
+    }
+    else
+        * size = * mtime = 0;
+
+    free (local);
+}
+
+/* Each line holds the start time, the loudness in 1/GAIN_UNIT LU, the peak in
+ * 1/PEAK_UNIT, the number of blocks, the size and modification time of the
+ * file, and the filename.  Integers are used so that the file does not depend
+ * on the locale.  Lines are only ever added, and a later line for the same
+ * song replaces an earlier one.  Lines from before sizes and times were saved
+ * do not parse and are skipped, so those songs are scanned again. */
+static void load_cache (void)
+{
+    char * path = cache_path ();
+    FILE * file = fopen (path, "r");
+    g_free (path);
+
+    if (! file)
+        return;
+
+    char * line = NULL;
+    size_t size = 0;
+
+    while (getline (& line, & size, file) > 0)
+    {
+        int start, loudness, peak, blocks, pos = 0;
+        long long fsize, mtime;
+
+        if (sscanf (line, "%d %d %d %d %lld %lld %n", & start, & loudness,
+         & peak, & blocks, & fsize, & mtime, & pos) < 6 || ! pos)
+            continue;
+
+        char * filename = line + pos;
+        filename[strcspn (filename, "\n")] = 0;
+
+        Result * result = g_slice_new (Result);
+        result->loudness = (float) loudness / GAIN_UNIT;
+        result->peak = (float) peak / PEAK_UNIT;
+        result->blocks = blocks;
+        result->size = fsize;
+        result->mtime = mtime;
+
+        g_hash_table_replace (cache, make_key (filename, start), result);
+    }
+
+    free (line);
+    fclose (file);
+}
+
+static void save_result (Track * track)
+{
+    if (! cache_file)
+    {
+        char * path = cache_path ();
+        cache_file = fopen (path, "a");
+        g_free (path);
+
+        if (! cache_file)
+            return;
+    }
+
+    fprintf (cache_file, "%d %d %d %d %lld %lld %s\n", track->start, (int)
+     lrintf (track->result.loudness * GAIN_UNIT), (int) lrintf
+     (track->result.peak * PEAK_UNIT), track->result.blocks, (long long)
+     track->result.size, (long long) track->result.mtime, track->filename);
+    fflush (cache_file);
+
+    Result * result = g_slice_new (Result);
+    * result = track->result;
+    g_hash_table_replace (cache, g_strdup (track->key), result);
+}
+
+static void result_free (void * result)
+{
+    g_slice_free (Result, result);
+}
+
+/* ---- output of the scans ---- */
+
+static bool_t scan_open_audio (int format, int rate, int channels)
+{
+    Scan * scan = current_scan;
+
+    if (__atomic_load_n (& stopping, __ATOMIC_RELAXED))
+        return FALSE;
+
+    /* the format may change partway through, but not the rate or channels */
+    if (scan->meter)
+    {
+        if (rate != scan->rate || channels != scan->channels)
+        {
+            scan->failed = TRUE;
+            return FALSE;
+        }
+
+        scan->format = format;
+        return TRUE;
+    }
+
+    if (! (scan->meter = meter_new (channels, rate)))
+    {
+        scan->failed = TRUE;
+        return FALSE;
+    }
+
+    scan->format = format;
+    scan->rate = rate;
+    scan->channels = channels;
+    return TRUE;
+}
+
+static void scan_set_replaygain_info (const ReplayGainInfo * info)
+{
+}
+
+static void scan_write_audio (void * data, int length)
+{
+    Scan * scan = current_scan;
+    int samples = length / FMT_SIZEOF (scan->format);
+
+    if (scan->format != FMT_FLOAT)
+    {
+        if (samples > scan->buffer_size)
+        {
+            scan->buffer = g_renew (float, scan->buffer, samples);
+            scan->buffer_size = samples;
+        }
+
+        audio_from_int (data, scan->format, scan->buffer, samples);
+        data = scan->buffer;
+    }
+
+    meter_add (scan->meter, data, samples / scan->channels);
+    scan->frames += samples / scan->channels;
+}
+
+static void scan_abort_write (void)
+{
+}
+
+static void scan_pause (bool_t pause)
+{
+}
+
+static int scan_written_time (void)
+{
+    Scan * scan = current_scan;
+
+    if (! scan->rate)
+        return scan->base_time;
+
+    return scan->base_time + scan->frames * 1000 / scan->rate;
+}
+
+/* Plugins flush to the start time before they begin; after that, a flush would
+ * mean that the audio is not all there. */
+static void scan_flush (int time)
+{
+    Scan * scan = current_scan;
+
+    if (scan->frames)
+        scan->failed = TRUE;
+
+    scan->base_time = time;
+}
+
+static const struct OutputAPI scan_output = {
+    .open_audio = scan_open_audio,
+    .set_replaygain_info = scan_set_replaygain_info,
+    .write_audio = scan_write_audio,
+    .abort_write = scan_abort_write,
+    .pause = scan_pause,
+    .written_time = scan_written_time,
+    .flush = scan_flush
+};
+
+/* These are called by the input plugins and must not lock the mutex, since it is
+ * held while stopping them. */
+
+static void scan_set_data (InputPlayback * playback, void * data)
+{
+    ((Scan *) playback)->data = data;
+}
+
+static void * scan_get_data (InputPlayback * playback)
+{
+    return ((Scan *) playback)->data;
+}
+
+static void scan_set_pb_ready (InputPlayback * playback)
+{
+    __atomic_store_n (& ((Scan *) playback)->ready, TRUE, __ATOMIC_RELEASE);
+}
+
+static void scan_set_params (InputPlayback * playback, int bitrate, int
+ samplerate, int channels)
+{
+}
+
+static void scan_set_tuple (InputPlayback * playback, Tuple * tuple)
+{
+    tuple_unref (tuple);
+}
+
+static void scan_set_gain_from_playlist (InputPlayback * playback)
+{
+}
+
+/* ---- scanning ---- */
+
+/* Returns TRUE if the track was decoded to the end. */
+static bool_t scan_track (Track * track)
+{
+    Scan scan = {
+        .playback = {
+            .output = & scan_output,
+            .set_data = scan_set_data,
+            .get_data = scan_get_data,
+            .set_pb_ready = scan_set_pb_ready,
+            .set_params = scan_set_params,
+            .set_tuple = scan_set_tuple,
+            .set_gain_from_playlist = scan_set_gain_from_playlist
+        },
+        .header = aud_plugin_get_header (track->decoder),
+        .track = track
+    };
+
+    if (! scan.header || ! scan.header->play)
+        return FALSE;
+
+    VFSFile * file = vfs_fopen (track->filename, "r");
+
+    pthread_mutex_lock (& mutex);
+    index_append (scans, & scan);
+    pthread_mutex_unlock (& mutex);
+
+    current_scan = & scan;
+    scan.header->play (& scan.playback, track->filename, file, track->start,
+     track->stop, FALSE);
+    current_scan = NULL;
+
+    pthread_mutex_lock (& mutex);
+
+    for (int i = 0; i < index_count (scans); i ++)
+    {
+        if (index_get (scans, i) == & scan)
+            index_delete (scans, i, 1);
+    }
+
+    pthread_mutex_unlock (& mutex);
+
+    if (file)
+        vfs_fclose (file);
+
+    bool_t complete = (scan.meter && ! scan.failed && ! scan.stopped);
+
+    /* A plugin may return without an error after a read failure. */
+    if (complete)
+    {
+        int end = (track->stop >= 0) ? track->stop : track->start + track->length;
+        int done = scan.base_time + scan.frames * 1000 / scan.rate;
+
+        if (track->length > 0 && done < end - 1000)
+        {
+            fprintf (stderr, "loudness: %s stopped early.\n", track->filename);
+            complete = FALSE;
+        }
+    }
+
+    if (complete)
+    {
+        track->result.loudness = meter_loudness (scan.meter, & track->result.blocks);
+        track->result.peak = meter_peak (scan.meter);
+    }
+
+    if (scan.meter)
+        meter_free (scan.meter);
+
+    g_free (scan.buffer);
+    return complete;
+}
+
+static bool_t is_shared (PluginHandle * decoder)
+{
+    const char * name = aud_plugin_get_basename (decoder);
+
+    for (int i = 0; i < G_N_ELEMENTS (shared_decoders); i ++)
+    {
+        if (! strcmp (name, shared_decoders[i]))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void finish_track (Track * track)
+{
+    if (-- track->album->unfinished == 0)
+    {
+        index_append (finished_albums, track->album);
+        pthread_cond_broadcast (& cond);
+    }
+}
+
+/* ---- writing tags ---- */
+
+static void set_gain (Tuple * tuple, int gain_field, int peak_field, float
+ loudness, float peak)
+{
+    tuple_set_int (tuple, gain_field, NULL, lrintf ((REFERENCE - loudness) * GAIN_UNIT));
+    tuple_set_int (tuple, peak_field, NULL, lrintf (peak * PEAK_UNIT));
+}
+
+static void write_track (Track * track, const Result * album)
+{
+    PluginHandle * decoder = track->decoder ? track->decoder :
+     aud_file_find_decoder (track->filename, FALSE);
+
+    if (! decoder)
+        return;
+
+    Tuple * tuple = aud_file_read_tuple (track->filename, decoder);
+
+    if (! tuple)
+        return;
+
+    tuple_set_int (tuple, FIELD_GAIN_GAIN_UNIT, NULL, GAIN_UNIT);
+    tuple_set_int (tuple, FIELD_GAIN_PEAK_UNIT, NULL, PEAK_UNIT);
+    set_gain (tuple, FIELD_GAIN_TRACK_GAIN, FIELD_GAIN_TRACK_PEAK,
+     track->result.loudness, track->result.peak);
+
+    if (album->blocks)
+        set_gain (tuple, FIELD_GAIN_ALBUM_GAIN, FIELD_GAIN_ALBUM_PEAK,
+         album->loudness, album->peak);
+
+    if (aud_file_write_tuple (track->filename, decoder, tuple))
+    {
+        /* Writing the tags changed the file, but not its loudness. */
+        pthread_mutex_lock (& mutex);
+        get_file_key (track->filename, & track->result.size, & track->result.mtime);
+        save_result (track);
+        index_append (rescans, str_get (track->filename));
+        pthread_mutex_unlock (& mutex);
+    }
+
+    tuple_unref (tuple);
+}
+
+/* The album loudness is the mean energy of the gated blocks of all its tracks,
+ * with each track gated on its own. */
+static void write_album (Album * album)
+{
+    Result total = {.loudness = METER_SILENCE};
+    double energy = 0;
+
+    for (int i = 0; i < index_count (album->tracks); i ++)
+    {
+        Track * track = index_get (album->tracks, i);
+
+        if (! track->scanned || ! track->result.blocks)
+            continue;
+
+        energy += track->result.blocks * pow (10, (track->result.loudness + 0.691) / 10);
+        total.blocks += track->result.blocks;
+        total.peak = fmaxf (total.peak, track->result.peak);
+    }
+
+    if (total.blocks)
+        total.loudness = -0.691 + 10 * log10 (energy / total.blocks);
+
+    /* Parts of a larger file (from a cue sheet) have no tags of their own. */
+    for (int i = 0; i < index_count (album->tracks); i ++)
+    {
+        Track * track = index_get (album->tracks, i);
+
+        if (track->scanned && track->result.blocks && ! track->start &&
+         track->stop < 0)
+            write_track (track, & total);
+    }
+}
+
+static void track_free (Track * track)
+{
+    g_hash_table_remove (queued, track->key);
+    str_unref (track->filename);
+    g_free (track->key);
+    g_slice_free (Track, track);
+}
+
+static void album_free (Album * album)
+{
+    for (int i = 0; i < index_count (album->tracks); i ++)
+        track_free (index_get (album->tracks, i));
+
+    index_free (album->tracks);
+    g_slice_free (Album, album);
+}
+
+/* ---- worker threads ---- */
+
+static void wait_a_while (int ms)
+{
+    struct timeval now;
+    gettimeofday (& now, NULL);
+
+    int64_t usec = (int64_t) now.tv_usec + 1000 * ms;
+    struct timespec until = {now.tv_sec + usec / 1000000, usec % 1000000 * 1000};
+    pthread_cond_timedwait (& cond, & mutex, & until);
+}
+
+static void * worker (void * unused)
+{
+    pthread_mutex_lock (& mutex);
+
+    while (! stopping)
+    {
+        if (index_count (finished_albums))
+        {
+            Album * album = index_get (finished_albums, 0);
+            index_delete (finished_albums, 0, 1);
+            working ++;
+            pthread_mutex_unlock (& mutex);
+
+            write_album (album);
+
+            pthread_mutex_lock (& mutex);
+            album_free (album);
+            working --;
+            continue;
+        }
+
+        if (! index_count (queue))
+        {
+            pthread_cond_wait (& cond, & mutex);
+            continue;
+        }
+
+        Track * track = index_get (queue, 0);
+        index_delete (queue, 0, 1);
+        working ++;
+
+        pthread_mutex_unlock (& mutex);
+        track->decoder = aud_file_find_decoder (track->filename, FALSE);
+        pthread_mutex_lock (& mutex);
+
+        if (track->decoder && is_shared (track->decoder))
+        {
+            pthread_mutex_unlock (& mutex);
+
+            bool_t scanned = scan_track (track);
+
+            pthread_mutex_lock (& mutex);
+
+            if (stopping)
+            {
+                working --;
+                break;
+            }
+
+            if (scanned)
+            {
+                track->scanned = TRUE;
+                save_result (track);
+            }
+        }
+        else if (track->decoder)
+            fprintf (stderr, "loudness: %s cannot be decoded alongside the "
+             "player; skipped.\n", track->filename);
+        else
+            fprintf (stderr, "loudness: No decoder found for %s.\n", track->filename);
+
+        finish_track (track);
+        working --;
+        pthread_cond_broadcast (& cond);
+    }
+
+    pthread_mutex_unlock (& mutex);
+    return NULL;
+}
+
+static void start_workers (void)
+{
+    int count = aud_get_int ("loudness", "threads");
+
+    if (count < 1)
+        count = sysconf (_SC_NPROCESSORS_ONLN);
+
+    count = CLAMP (count, 1, MAX_THREADS);
+
+    while (n_threads < count)
+    {
+        if (pthread_create (& threads[n_threads], NULL, worker, NULL))
+            break;
+
+        n_threads ++;
+    }
+}
+
+/* ---- main thread ---- */
+
+static int update_cb (void * unused)
+{
+    pthread_mutex_lock (& mutex);
+
+    Index * files = rescans;
+    rescans = index_new ();
+
+    bool_t idle = ! working && ! index_count (queue) && ! index_count
+     (finished_albums);
+
+    if (idle)
+        update_source = 0;
+
+    pthread_mutex_unlock (& mutex);
+
+    for (int i = 0; i < index_count (files); i ++)
+    {
+        char * filename = index_get (files, i);
+        aud_playlist_rescan_file (filename);
+        str_unref (filename);
+    }
+
+    index_free (files);
+    return ! idle;
+}
+
+/* Songs with the same album name in the same folder make up an album. */
+static char * album_key (const char * filename, Tuple * tuple)
+{
+    char * album = tuple ? tuple_get_str (tuple, FIELD_ALBUM, NULL) : NULL;
+
+    if (! album)
+        return NULL;
+
+    const char * slash = strrchr (filename, '/');
+    int folder = slash ? slash - filename : 0;
+    char * key = g_strdup_printf ("%.*s/%s", folder, filename, album);
+
+    str_unref (album);
+    return key;
+}
+
+static void add_entry (int list, int entry, GHashTable * albums)
+{
+    char * filename = aud_playlist_entry_get_filename (list, entry);
+    Tuple * tuple = aud_playlist_entry_get_tuple (list, entry, TRUE);
+    int start = 0, stop = -1, length = -1;
+
+    if (tuple)
+    {
+        if (tuple_get_value_type (tuple, FIELD_SEGMENT_START, NULL) == TUPLE_INT)
+            start = tuple_get_int (tuple, FIELD_SEGMENT_START, NULL);
+        if (tuple_get_value_type (tuple, FIELD_SEGMENT_END, NULL) == TUPLE_INT)
+            stop = tuple_get_int (tuple, FIELD_SEGMENT_END, NULL);
+        if (tuple_get_value_type (tuple, FIELD_LENGTH, NULL) == TUPLE_INT)
+            length = tuple_get_int (tuple, FIELD_LENGTH, NULL);
+    }
+
+    char * key = make_key (filename, start);
+    int64_t size, mtime;
+
+    if (g_hash_table_lookup (queued, key))
+    {
+        g_free (key);
+        goto DONE;
+    }
+
+    Track * track = g_slice_new0 (Track);
+    track->filename = str_ref (filename);
+    track->key = key;
+    track->start = start;
+    track->stop = stop;
+    track->length = length;
+
+    get_file_key (filename, & size, & mtime);
+    track->result.size = size;
+    track->result.mtime = mtime;
+
+    g_hash_table_insert (queued, key, track);
+
+    char * name = album_key (filename, tuple);
+    Album * album = name ? g_hash_table_lookup (albums, name) : NULL;
+
+    if (! album)
+    {
+        album = g_slice_new0 (Album);
+        album->tracks = index_new ();
+        album->unfinished = 1; /* released once all the entries are added */
+
+        g_hash_table_insert (albums, name ? name : g_strdup (key), album);
+    }
+    else
+        g_free (name);
+
+    track->album = album;
+    index_append (album->tracks, track);
+
+    Result * result = g_hash_table_lookup (cache, key);
+
+    if (result && result->size == size && result->mtime == mtime)
+    {
+        track->result = * result;
+        track->scanned = TRUE;
+    }
+    else
+    {
+        album->unfinished ++;
+        index_append (queue, track);
+    }
+
+DONE:
+    str_unref (filename);
+    if (tuple)
+        tuple_unref (tuple);
+}
+
+static void release_album (void * key, void * album, void * unused)
+{
+    if (-- ((Album *) album)->unfinished == 0)
+        index_append (finished_albums, album);
+}
+
+/* Scans the selected songs in the active playlist, or all of them if none are
+ * selected.  Songs which have been scanned before are not decoded again, but
+ * their tags are still written, since they count toward their albums. */
+static void scan_playlist (void)
+{
+    int list = aud_playlist_get_active ();
+    int entries = aud_playlist_entry_count (list);
+    bool_t selected = (aud_playlist_selected_count (list) > 0);
+    GHashTable * albums = g_hash_table_new_full (g_str_hash, g_str_equal,
+     g_free, NULL);
+
+    pthread_mutex_lock (& mutex);
+
+    start_workers ();
+
+    for (int entry = 0; entry < entries; entry ++)
+    {
+        if (! selected || aud_playlist_entry_get_selected (list, entry))
+            add_entry (list, entry, albums);
+    }
+
+    g_hash_table_foreach (albums, release_album, NULL);
+    pthread_cond_broadcast (& cond);
+
+    if (! update_source)
+        update_source = g_timeout_add (UPDATE_DELAY, update_cb, NULL);
+
+    pthread_mutex_unlock (& mutex);
+
+    g_hash_table_destroy (albums);
+}
+
+/* The input plugins are stopped as the player would stop them, once each has
+ * said that it is ready. */
+static void stop_scans (void)
+{
+    for (int i = 0; i < index_count (scans); i ++)
+    {
+        Scan * scan = index_get (scans, i);
+
+        if (! scan->stopped && __atomic_load_n (& scan->ready, __ATOMIC_ACQUIRE))
+        {
+            scan->stopped = TRUE;
+
+            if (scan->header->stop)
+                scan->header->stop (& scan->playback);
+        }
+    }
+
+}
+
+static bool_t loudness_init (void)
+{
+    aud_config_set_defaults ("loudness", loudness_defaults);
+
+    queue = index_new ();
+    finished_albums = index_new ();
+    rescans = index_new ();
+    scans = index_new ();
+
+    cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, result_free);
+    queued = g_hash_table_new (g_str_hash, g_str_equal);
+
+    load_cache ();
+
+    aud_plugin_menu_add (AUD_MENU_PLAYLIST, scan_playlist, _("Scan Loudness"), NULL);
+    aud_plugin_menu_add (AUD_MENU_PLAYLIST_RCLICK, scan_playlist,
+     _("Scan Loudness"), NULL);
+
+    return TRUE;
+}
+
+static void loudness_cleanup (void)
+{
+    aud_plugin_menu_remove (AUD_MENU_PLAYLIST, scan_playlist);
+    aud_plugin_menu_remove (AUD_MENU_PLAYLIST_RCLICK, scan_playlist);
+
+    pthread_mutex_lock (& mutex);
+
+    __atomic_store_n (& stopping, TRUE, __ATOMIC_RELAXED);
+    pthread_cond_broadcast (& cond);
+
+    while (working)
+    {
+        stop_scans ();
+        wait_a_while (WAIT_DELAY);
+    }
+
+    pthread_mutex_unlock (& mutex);
+
+    for (int i = 0; i < n_threads; i ++)
+        pthread_join (threads[i], NULL);
+
+    n_threads = 0;
+    stopping = FALSE;
+
+    if (update_source)
+    {
+        g_source_remove (update_source);
+        update_source = 0;
+    }
+
+    /* Tracks are freed with their albums; collect the albums from the tracks
+     * still waiting as well as from the finished list. */
+    GHashTable * albums = g_hash_table_new (g_direct_hash, g_direct_equal);
+    GHashTableIter iter;
+    void * track;
+
+    g_hash_table_iter_init (& iter, queued);
+    while (g_hash_table_iter_next (& iter, NULL, & track))
+        g_hash_table_insert (albums, ((Track *) track)->album, NULL);
+
+    g_hash_table_iter_init (& iter, albums);
+    void * album;
+
+    while (g_hash_table_iter_next (& iter, & album, NULL))
+        album_free (album);
+
+    g_hash_table_destroy (albums);
+
+    for (int i = 0; i < index_count (rescans); i ++)
+        str_unref (index_get (rescans, i));
+
+    index_free (queue);
+    index_free (finished_albums);
+    index_free (rescans);
+    index_free (scans);
+
+    g_hash_table_destroy (cache);
+    g_hash_table_destroy (queued);
+
+    if (cache_file)
+    {
+        fclose (cache_file);
+        cache_file = NULL;
+    }
+}
+
+static const char loudness_about[] =
+ N_("Loudness Scanner Plugin\n\n"
+    "Measures the loudness of songs according to EBU R128 and writes it to "
+    "their tags as ReplayGain information.  Choose \"Scan Loudness\" from the "
+    "playlist menu to scan the selected songs, or the whole playlist if none "
+    "are selected.");
+
+static const PreferencesWidget loudness_widgets[] = {
+ {WIDGET_LABEL, N_("<b>Scanning</b>")},
+ {WIDGET_SPIN_BTN, N_("Threads:"),
+  .cfg_type = VALUE_INT, .csect = "loudness", .cname = "threads",
+  .data = {.spin_btn = {0, MAX_THREADS, 1, N_("(0 for one per CPU)")}}}};
+
+static const PluginPreferences loudness_prefs = {
+ .widgets = loudness_widgets,
+ .n_widgets = sizeof loudness_widgets / sizeof loudness_widgets[0]};
+
+AUD_GENERAL_PLUGIN
+(
+    .name = N_("Loudness Scanner"),
+    .domain = PACKAGE,
+    .about_text = loudness_about,
+    .prefs = & loudness_prefs,
+    .init = loudness_init,
+    .cleanup = loudness_cleanup
+)
@@ -0,0 +1,266 @@
+/*
+ * EBU R128 Loudness Meter
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dsp/dsp.h"
+
+#include "meter.h"
+
+/* This follows ITU-R BS.1770-3.  Each channel goes through the K-weighting
+ * filter (a high shelf and then a high pass, each a biquad) and the weighted
+ * mean squares of the channels are summed.  The sums are kept for every 100 ms
+ * and combined four at a time into overlapping 400 ms blocks.
+ *
+ * Rather than keeping every block for the gating at the end, the blocks are
+ * counted into a histogram with 0.01 LU bins, which also stores the sum of the
+ * blocks' energies in each bin.  The relative gate therefore falls on a bin
+ * boundary, which changes the result by far less than 0.01 LU. */
+
+#define BIN_STEP 100 /* bins per LU */
+#define BIN_MAX 5 /* LUFS; louder blocks go in the top bin */
+#define BINS ((BIN_MAX - METER_SILENCE) * BIN_STEP)
+#define RELATIVE_GATE 10 /* LU */
+
+#define SUBBLOCKS 4 /* per block */
+
+struct Meter {
+    int channels;
+    float weight[METER_MAX_CHANNELS];
+
+    double b[2][3], a[2][3];
+    double z[METER_MAX_CHANNELS][2][2];
+
+    int sub_frames, sub_at;
+    double sub_sum;
+    double subs[SUBBLOCKS];
+    int n_subs;
+
+    double bin_energy[BINS];
+    int bin_count[BINS];
+
+    float tp_filter[(DSP_TP_PHASES - 1) * DSP_TP_TAPS];
+    float history[METER_MAX_CHANNELS][2 * DSP_TP_TAPS];
+    int history_at;
+    float peak;
+};
+
+static double energy_to_loudness (double energy)
+{
+    return -0.691 + 10 * log10 (energy);
+}
+
+/* The filter coefficients in BS.1770 are given for 48 kHz only; these are the
+ * analog prototypes from which they come, so that any rate can be used. */
+static void make_filters (Meter * m, int rate)
+{
+    double f0 = 1681.974450955533;
+    double gain = 3.999843853973347;
+    double q = 0.7071752369554196;
+
+    double k = tan (M_PI * f0 / rate);
+    double vh = pow (10, gain / 20);
+    double vb = pow (vh, 0.4996667741545416);
+    double a0 = 1 + k / q + k * k;
+
+    m->b[0][0] = (vh + vb * k / q + k * k) / a0;
+    m->b[0][1] = 2 * (k * k - vh) / a0;
+    m->b[0][2] = (vh - vb * k / q + k * k) / a0;
+    m->a[0][1] = 2 * (k * k - 1) / a0;
+    m->a[0][2] = (1 - k / q + k * k) / a0;
+
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+
+    k = tan (M_PI * f0 / rate);
+    a0 = 1 + k / q + k * k;
+
+    m->b[1][0] = 1;
+    m->b[1][1] = -2;
+    m->b[1][2] = 1;
+    m->a[1][1] = 2 * (k * k - 1) / a0;
+    m->a[1][2] = (1 - k / q + k * k) / a0;
+}
+
+/* The surround channels count for 1.41 times as much as the front ones, and
+ * the LFE channel is left out.  The layouts are the usual ones (L, R, C, LFE,
+ * then the surrounds, except that quad and 5.0 have no LFE). */
+static void set_weights (Meter * m)
+{
+    for (int c = 0; c < m->channels; c ++)
+    {
+        if (m->channels >= 6 && c == 3)
+            m->weight[c] = 0;
+        else if ((m->channels == 4 && c >= 2) || (m->channels >= 5 && c >= 3))
+            m->weight[c] = 1.41;
+        else
+            m->weight[c] = 1;
+    }
+}
+
+Meter * meter_new (int channels, int rate)
+{
+    if (channels < 1 || channels > METER_MAX_CHANNELS || rate < 1000)
+        return NULL;
+
+    Meter * m = calloc (1, sizeof (Meter));
+
+    m->channels = channels;
+    m->sub_frames = (rate + 5) / 10;
+
+    make_filters (m, rate);
+    set_weights (m);
+    dsp_true_peak_filter (m->tp_filter);
+
+    return m;
+}
+
+void meter_free (Meter * m)
+{
+    free (m);
+}
+
+static void add_block (Meter * m, double energy)
+{
+    if (energy <= 0)
+        return;
+
+    double loudness = energy_to_loudness (energy);
+
+    if (loudness < METER_SILENCE)
+        return;
+
+    int bin = (loudness - METER_SILENCE) * BIN_STEP;
+
+    if (bin >= BINS)
+        bin = BINS - 1;
+
+    m->bin_energy[bin] += energy;
+    m->bin_count[bin] ++;
+}
+
+static void end_subblock (Meter * m)
+{
+    memmove (m->subs, m->subs + 1, sizeof m->subs - sizeof m->subs[0]);
+    m->subs[SUBBLOCKS - 1] = m->sub_sum / m->sub_frames;
+
+    if (m->n_subs < SUBBLOCKS)
+        m->n_subs ++;
+
+    if (m->n_subs == SUBBLOCKS)
+    {
+        double sum = 0;
+
+        for (int i = 0; i < SUBBLOCKS; i ++)
+            sum += m->subs[i];
+
+        add_block (m, sum / SUBBLOCKS);
+    }
+
+    m->sub_sum = 0;
+    m->sub_at = 0;
+}
+
+static double weight_sample (Meter * m, int c, double x)
+{
+    for (int f = 0; f < 2; f ++)
+    {
+        double * z = m->z[c][f];
+        double y = m->b[f][0] * x + z[0];
+
+        z[0] = m->b[f][1] * x - m->a[f][1] * y + z[1];
+        z[1] = m->b[f][2] * x - m->a[f][2] * y;
+        x = y;
+    }
+
+    return x;
+}
+
+static void check_peak (Meter * m, int c, float x)
+{
+    float * h = m->history[c];
+
+    h[m->history_at] = h[m->history_at + DSP_TP_TAPS] = x;
+
+    m->peak = fmaxf (m->peak, dsp_true_peak (h + m->history_at + 1,
+     m->tp_filter));
+}
+
+void meter_add (Meter * m, const float * data, int frames)
+{
+    while (frames --)
+    {
+        for (int c = 0; c < m->channels; c ++)
+        {
+            double y = weight_sample (m, c, data[c]);
+
+            m->sub_sum += m->weight[c] * y * y;
+            check_peak (m, c, data[c]);
+        }
+
+        m->history_at = (m->history_at + 1) % DSP_TP_TAPS;
+
+        if (++ m->sub_at == m->sub_frames)
+            end_subblock (m);
+
+        data += m->channels;
+    }
+}
+
+double meter_loudness (const Meter * m, int * blocks)
+{
+    double energy = 0;
+    int count = 0;
+
+    for (int i = 0; i < BINS; i ++)
+    {
+        energy += m->bin_energy[i];
+        count += m->bin_count[i];
+    }
+
+    * blocks = 0;
+
+    if (! count)
+        return METER_SILENCE;
+
+    double gate = energy_to_loudness (energy / count) - RELATIVE_GATE;
+    int first = ceil ((gate - METER_SILENCE) * BIN_STEP);
+
+    energy = 0;
+    count = 0;
+
+    for (int i = (first > 0) ? first : 0; i < BINS; i ++)
+    {
+        energy += m->bin_energy[i];
+        count += m->bin_count[i];
+    }
+
+    if (! count)
+        return METER_SILENCE;
+
+    * blocks = count;
+    return energy_to_loudness (energy / count);
+}
+
+float meter_peak (const Meter * m)
+{
+    return m->peak;
+}
@@ -0,0 +1,45 @@
+/*
+ * EBU R128 Loudness Meter
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef LOUDNESS_METER_H
+#define LOUDNESS_METER_H
+
+#define METER_MAX_CHANNELS 8
+
+/* Loudness below this (in LUFS) is treated as silence. */
+#define METER_SILENCE -70
+
+typedef struct Meter Meter;
+
+/* Returns NULL if the channel count is not supported. */
+Meter * meter_new (int channels, int rate);
+void meter_free (Meter * meter);
+
+/* Adds <frames> frames of interleaved audio. */
+void meter_add (Meter * meter, const float * data, int frames);
+
+/* Returns the integrated (gated) loudness in LUFS of all the audio added so
+ * far, and sets <blocks> to the number of 400 ms blocks which passed the gates.
+ * If no blocks did, METER_SILENCE is returned and <blocks> is set to zero. */
+double meter_loudness (const Meter * meter, int * blocks);
+
+/* Returns the highest true peak (found by 4x oversampling) so far. */
+float meter_peak (const Meter * meter);
+
+#endif
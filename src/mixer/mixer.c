@@ -17,8 +17,7 @@
  * the use of this software.
  */
 
-/* TODO: implement more surround converters */
-
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -27,96 +26,32 @@
 #include <audacious/plugin.h>
 #include <audacious/preferences.h>
 
-#define MAX_CHANNELS 8
-
-typedef void (* Converter) (float * * data, int * samples);
-
-static float * mixer_buf;
-
-static void mono_to_stereo (float * * data, int * samples)
-{
-    int frames = * samples;
-    float * get = * data;
-    float * set = mixer_buf = realloc (mixer_buf, sizeof (float) * 2 * frames);
-
-    * data = mixer_buf;
-    * samples = 2 * frames;
+#include "dsp/dsp.h"
 
-    while (frames --)
-    {
-        float val = * get ++;
-        * set ++ = val;
-        * set ++ = val;
-    }
-}
-
-static void stereo_to_mono (float * * data, int * samples)
-{
-    int frames = * samples / 2;
-    float * get = * data;
-    float * set = mixer_buf = realloc (mixer_buf, sizeof (float) * frames);
-
-    * data = mixer_buf;
-    * samples = frames;
-
-    while (frames --)
-    {
-        float val = * get ++;
-        val += * get ++;
-        * set ++ = val / 2;
-    }
-}
+#define MAX_CHANNELS DSP_MAX_CHANNELS
 
-static void quadro_to_stereo (float * * data, int * samples)
-{
-    int frames = * samples / 4;
-    float * get = * data;
-    float * set = mixer_buf = realloc (mixer_buf, sizeof (float) * 2 * frames);
+/* The output buffer is allocated at start for blocks of up to this length and
+ * only grows if a longer one arrives. */
+#define BLOCK_TIME 500 /* ms */
 
-    * data = mixer_buf;
-    * samples = 2 * frames;
+/* Any layout of 1 to MAX_CHANNELS channels can be converted to any other.  The
+ * coefficients (one row per output channel) are worked out once at start; see
+ * dsp_remix_matrix() for how each speaker is mapped. */
+static float matrix[MAX_CHANNELS * MAX_CHANNELS];
+static float * mixer_buf;
+static int mixer_buf_frames;
 
-    while (frames --)
-    {
-        float front_left  = * get ++;
-        float front_right = * get ++;
-        float back_left   = * get ++;
-        float back_right  = * get ++;
-        * set ++ = front_left + (back_left * 0.7);
-        * set ++ = front_right + (back_right * 0.7);
-    }
-}
+static int input_channels, output_channels;
 
-static void surround_5p1_to_stereo (float * * data, int * samples)
+static void enlarge_buffer (int frames)
 {
-    int frames = * samples / 6;
-    float * get = * data;
-    float * set = mixer_buf = realloc (mixer_buf, sizeof (float) * 2 * frames);
-
-    * data = mixer_buf;
-    * samples = 2 * frames;
-
-    while (frames --)
+    if (mixer_buf_frames < frames)
     {
-        float front_left  = * get ++;
-        float front_right = * get ++;
-        float center = * get ++;
-        float lfe    = * get ++;
-        float rear_left   = * get ++;
-        float rear_right  = * get ++;
-        * set ++ = front_left + (center * 0.5) + (lfe * 0.5) + (rear_left * 0.5);
-        * set ++ = front_right + (center * 0.5) + (lfe * 0.5) + (rear_right * 0.5);
+        mixer_buf_frames = frames;
+        mixer_buf = realloc (mixer_buf, sizeof (float) * output_channels * frames);
     }
 }
 
-static const Converter converters[MAX_CHANNELS + 1][MAX_CHANNELS + 1] = {
- [1][2] = mono_to_stereo,
- [2][1] = stereo_to_mono,
- [4][2] = quadro_to_stereo,
- [6][2] = surround_5p1_to_stereo};
-
-static int input_channels, output_channels;
-
 void mixer_start (int * channels, int * rate)
 {
     input_channels = * channels;
@@ -126,14 +61,22 @@ void mixer_start (int * channels, int * rate)
     if (input_channels == output_channels)
         return;
 
-    if (input_channels < 1 || input_channels > MAX_CHANNELS ||
-     ! converters[input_channels][output_channels])
+    if (input_channels < 1 || input_channels > MAX_CHANNELS)
     {
         fprintf (stderr, "Converting %d to %d channels is not implemented.\n",
          input_channels, output_channels);
+        output_channels = input_channels;
         return;
     }
 
+    dsp_remix_matrix (input_channels, output_channels, matrix);
+
+    /* the buffer size depends on the output channels, so start over */
+    free (mixer_buf);
+    mixer_buf = NULL;
+    mixer_buf_frames = 0;
+    enlarge_buffer ((int64_t) * rate * BLOCK_TIME / 1000);
+
     * channels = output_channels;
 }
 
@@ -142,11 +85,13 @@ void mixer_process (float * * data, int * samples)
     if (input_channels == output_channels)
         return;
 
-    if (input_channels < 1 || input_channels > MAX_CHANNELS ||
-     ! converters[input_channels][output_channels])
-        return;
+    int frames = * samples / input_channels;
+    enlarge_buffer (frames);
 
-    converters[input_channels][output_channels] (data, samples);
+    dsp_remix (* data, input_channels, mixer_buf, output_channels, matrix, frames);
+
+    * data = mixer_buf;
+    * samples = output_channels * frames;
 }
 
 static const char * const mixer_defaults[] = {
@@ -163,6 +108,7 @@ static void mixer_cleanup (void)
 {
     free (mixer_buf);
     mixer_buf = 0;
+    mixer_buf_frames = 0;
 }
 
 static const char mixer_about[] =
@@ -0,0 +1,493 @@
+/*
+ * Copyright (c) 2013 Audacious developers.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include <libaudcore/audstrings.h>
+#include <audacious/debug.h>
+#include <audacious/misc.h>
+
+#include "cache.h"
+
+/* Files are usually probed, read and played one after another, so a small
+ * cache is enough to catch all three even while a large folder is added. */
+#define CACHE_SIZE 64
+
+/* Seek indexes are saved in a folder of their own, one file per track, named
+ * after a hash of the URI.  Each file is an IndexHeader followed by <fill>
+ * 64-bit offsets, all in the byte order of the machine that wrote it. */
+#define INDEX_FOLDER "mpg123-index"
+#define INDEX_MAGIC "AUDMP3IX"
+#define INDEX_VERSION 1
+#define INDEX_MAX_FILL (1 << 24)
+
+/* Reading through a shorter file to seek is quick enough. */
+#define INDEX_MIN_LENGTH 300 /* seconds */
+
+/* Beyond this many files, the ones written longest ago are deleted. */
+#define INDEX_MAX_FILES 200
+
+typedef struct {
+	char magic[8];
+	int32_t version;
+	int32_t scanned;
+	int64_t size, mtime;
+	int64_t length, step, fill;
+} IndexHeader;
+
+typedef struct {
+	char * filename;
+	int64_t size, mtime;
+	unsigned used;
+	ScanInfo info;
+} CacheEntry;
+
+typedef struct {
+	char * filename;
+	char * data;
+	size_t length;
+} IndexSave;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static CacheEntry cache[CACHE_SIZE];
+static unsigned use_count;
+
+/* Seek indexes are written by a thread of their own, so that the end of a song
+ * is not held up by the disk.  It runs while there are any waiting. */
+static pthread_mutex_t save_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t save_cond = PTHREAD_COND_INITIALIZER;
+static GQueue save_queue = G_QUEUE_INIT;
+static bool_t save_running;
+
+static off_t * copy_index (const off_t * index, size_t fill)
+{
+	if (! index || ! fill)
+		return NULL;
+
+	off_t * copy = malloc (sizeof (off_t) * fill);
+	memcpy (copy, index, sizeof (off_t) * fill);
+	return copy;
+}
+
+void scan_info_from_decoder (ScanInfo * info, mpg123_handle * decoder)
+{
+	int encoding;
+	off_t * index = NULL;
+
+	memset (info, 0, sizeof (ScanInfo));
+
+	if (mpg123_getformat (decoder, & info->rate, & info->channels, & encoding) < 0)
+		info->rate = info->channels = 0;
+	if (mpg123_info (decoder, & info->info) < 0)
+		memset (& info->info, 0, sizeof info->info);
+
+	info->length = mpg123_length (decoder);
+
+	if (mpg123_index (decoder, & index, & info->index_step, & info->index_fill) < 0)
+		info->index_fill = 0;
+
+	info->index = copy_index (index, info->index_fill);
+}
+
+/* The index has an entry for every <step>th frame, and mpg123 makes the steps
+ * longer as the index fills up, so the number of entries alone says little. */
+static int64_t index_coverage (const ScanInfo * info)
+{
+	return (int64_t) info->index_step * info->index_fill;
+}
+
+void scan_info_to_decoder (const ScanInfo * info, mpg123_handle * decoder)
+{
+	if (! info->index_fill)
+		return;
+
+	/* mpg123 copies the index */
+	if (mpg123_set_index (decoder, info->index, info->index_step,
+	 info->index_fill) < 0)
+		AUDDBG ("Cannot use stored seek index: %s\n", mpg123_strerror (decoder));
+}
+
+void scan_info_clear (ScanInfo * info)
+{
+	free (info->index);
+	info->index = NULL;
+	info->index_fill = 0;
+}
+
+/* Local files can also be checked for changes by their modification time; for
+ * others, only the size is known. */
+static void get_key (const char * filename, VFSFile * file, int64_t * size,
+ int64_t * mtime)
+{
+	* size = vfs_fsize (file);
+	* mtime = 0;
+
+	char * local = uri_to_filename (filename);
+	struct stat st;
+
+	if (local && ! stat (local, & st))
+		* mtime = st.st_mtime;
+
+	free (local);
+}
+
+static CacheEntry * find_entry (const char * filename)
+{
+	for (int i = 0; i < CACHE_SIZE; i ++)
+	{
+		if (cache[i].filename && ! strcmp (cache[i].filename, filename))
+			return & cache[i];
+	}
+
+	return NULL;
+}
+
+static void clear_entry (CacheEntry * entry)
+{
+	free (entry->filename);
+	scan_info_clear (& entry->info);
+	memset (entry, 0, sizeof (CacheEntry));
+}
+
+bool_t scan_cache_lookup (const char * filename, VFSFile * file, ScanInfo * info)
+{
+	if (vfs_is_streaming (file))
+		return FALSE;
+
+	int64_t size, mtime;
+	get_key (filename, file, & size, & mtime);
+
+	pthread_mutex_lock (& mutex);
+
+	CacheEntry * entry = find_entry (filename);
+
+	if (entry && (entry->size != size || entry->mtime != mtime))
+	{
+		clear_entry (entry);
+		entry = NULL;
+	}
+
+	if (entry)
+	{
+		entry->used = ++ use_count;
+		* info = entry->info;
+		info->index = copy_index (entry->info.index, entry->info.index_fill);
+	}
+
+	pthread_mutex_unlock (& mutex);
+
+	return entry != NULL;
+}
+
+void scan_cache_store (const char * filename, VFSFile * file, const ScanInfo * info)
+{
+	if (vfs_is_streaming (file) || info->rate <= 0)
+		return;
+
+	int64_t size, mtime;
+	get_key (filename, file, & size, & mtime);
+
+	pthread_mutex_lock (& mutex);
+
+	CacheEntry * entry = find_entry (filename);
+
+	/* Keep what we have if it is at least as good. */
+	if (entry && entry->size == size && entry->mtime == mtime &&
+	 ((entry->info.scanned && ! info->scanned) || index_coverage
+	 (& entry->info) > index_coverage (info)))
+		goto DONE;
+
+	if (! entry)
+	{
+		/* replace the entry used longest ago */
+		entry = & cache[0];
+		for (int i = 1; i < CACHE_SIZE; i ++)
+		{
+			if (cache[i].used < entry->used)
+				entry = & cache[i];
+		}
+	}
+
+	clear_entry (entry);
+
+	entry->filename = strdup (filename);
+	entry->size = size;
+	entry->mtime = mtime;
+	entry->used = ++ use_count;
+	entry->info = * info;
+	entry->info.index = copy_index (info->index, info->index_fill);
+
+DONE:
+	pthread_mutex_unlock (& mutex);
+}
+
+void scan_cache_cleanup (void)
+{
+	pthread_mutex_lock (& save_mutex);
+
+	while (save_running)
+		pthread_cond_wait (& save_cond, & save_mutex);
+
+	pthread_mutex_unlock (& save_mutex);
+
+	pthread_mutex_lock (& mutex);
+
+	for (int i = 0; i < CACHE_SIZE; i ++)
+		clear_entry (& cache[i]);
+
+	pthread_mutex_unlock (& mutex);
+}
+
+static char * index_path (const char * filename)
+{
+	char * hash = g_compute_checksum_for_string (G_CHECKSUM_SHA1, filename, -1);
+	char * path = g_build_filename (aud_get_path (AUD_PATH_USER_DIR),
+	 INDEX_FOLDER, hash, NULL);
+
+	g_free (hash);
+	return path;
+}
+
+int64_t scan_index_load (const char * filename, VFSFile * file, ScanInfo * info)
+{
+	if (vfs_is_streaming (file))
+		return 0;
+
+	char * path = index_path (filename);
+	char * data = NULL;
+	size_t length = 0;
+	int64_t coverage = 0;
+
+	if (! g_file_get_contents (path, & data, & length, NULL) || length <
+	 sizeof (IndexHeader))
+		goto DONE;
+
+	IndexHeader header;
+	memcpy (& header, data, sizeof header);
+
+	int64_t size, mtime;
+	get_key (filename, file, & size, & mtime);
+
+	if (memcmp (header.magic, INDEX_MAGIC, sizeof header.magic) ||
+	 header.version != INDEX_VERSION || header.size != size || header.mtime !=
+	 mtime || header.step < 1 || header.fill < 1 || header.fill >
+	 INDEX_MAX_FILL || length != sizeof header + sizeof (int64_t) * header.fill)
+	{
+		AUDDBG ("Ignoring stale seek index %s.\n", path);
+		goto DONE;
+	}
+
+	coverage = header.step * header.fill;
+
+	if (coverage <= index_coverage (info))
+		goto DONE;
+
+	const int64_t * offsets = (const int64_t *) (data + sizeof header);
+
+	free (info->index);
+	info->index = malloc (sizeof (off_t) * header.fill);
+
+	for (int64_t i = 0; i < header.fill; i ++)
+		info->index[i] = offsets[i];
+
+	info->index_step = header.step;
+	info->index_fill = header.fill;
+
+	if (header.scanned)
+	{
+		info->scanned = TRUE;
+		info->length = header.length;
+	}
+
+	AUDDBG ("Loaded seek index with %d entries for %s.\n", (int) header.fill,
+	 filename);
+
+DONE:
+	g_free (data);
+	g_free (path);
+	return coverage;
+}
+
+static void index_save_free (IndexSave * save)
+{
+	free (save->filename);
+	free (save->data);
+	g_slice_free (IndexSave, save);
+}
+
+typedef struct {
+	char * path;
+	int64_t mtime;
+} IndexFile;
+
+static int compare_mtime (const void * a, const void * b)
+{
+	int64_t ta = ((const IndexFile *) a)->mtime, tb = ((const IndexFile *) b)->mtime;
+	return (ta > tb) - (ta < tb);
+}
+
+/* Deletes the files written longest ago until at most INDEX_MAX_FILES remain. */
+static void prune_index_folder (const char * folder)
+{
+	GDir * dir = g_dir_open (folder, 0, NULL);
+	if (! dir)
+		return;
+
+	GArray * files = g_array_new (FALSE, FALSE, sizeof (IndexFile));
+	const char * name;
+
+	while ((name = g_dir_read_name (dir)))
+	{
+		IndexFile file = {g_build_filename (folder, name, NULL)};
+		struct stat st;
+
+		if (stat (file.path, & st) || ! S_ISREG (st.st_mode))
+		{
+			g_free (file.path);
+			continue;
+		}
+
+		file.mtime = st.st_mtime;
+		g_array_append_val (files, file);
+	}
+
+	g_dir_close (dir);
+
+	if (files->len > INDEX_MAX_FILES)
+		g_array_sort (files, compare_mtime);
+
+	for (unsigned i = 0; i < files->len; i ++)
+	{
+		IndexFile * file = & g_array_index (files, IndexFile, i);
+
+		if (i + INDEX_MAX_FILES < files->len)
+			unlink (file->path);
+
+		g_free (file->path);
+	}
+
+	g_array_free (files, TRUE);
+}
+
+static void write_index (IndexSave * save)
+{
+	char * path = index_path (save->filename);
+	char * folder = g_path_get_dirname (path);
+	GError * error = NULL;
+
+	if (g_mkdir_with_parents (folder, 0755) < 0 || ! g_file_set_contents (path,
+	 save->data, save->length, & error))
+	{
+		fprintf (stderr, "mpg123: Cannot save seek index to %s: %s.\n", path,
+		 error ? error->message : strerror (errno));
+
+		if (error)
+			g_error_free (error);
+	}
+	else
+		prune_index_folder (folder);
+
+	g_free (folder);
+	g_free (path);
+}
+
+static void * save_worker (void * unused)
+{
+	pthread_mutex_lock (& save_mutex);
+
+	IndexSave * save;
+
+	while ((save = g_queue_pop_head (& save_queue)))
+	{
+		pthread_mutex_unlock (& save_mutex);
+		write_index (save);
+		index_save_free (save);
+		pthread_mutex_lock (& save_mutex);
+	}
+
+	save_running = FALSE;
+	pthread_cond_broadcast (& save_cond);
+	pthread_mutex_unlock (& save_mutex);
+	return NULL;
+}
+
+void scan_index_save (const char * filename, VFSFile * file, const ScanInfo *
+ info, int64_t saved)
+{
+	if (vfs_is_streaming (file) || index_coverage (info) <= saved ||
+	 info->rate <= 0 || info->length < (int64_t) INDEX_MIN_LENGTH * info->rate ||
+	 info->index_fill > INDEX_MAX_FILL)
+		return;
+
+	/* A constant bitrate stream can be seeked in without an index. */
+	if (info->info.vbr == MPG123_CBR && ! info->scanned)
+		return;
+
+	IndexHeader header = {
+	 .version = INDEX_VERSION,
+	 .scanned = info->scanned,
+	 .length = info->length,
+	 .step = info->index_step,
+	 .fill = info->index_fill};
+
+	memcpy (header.magic, INDEX_MAGIC, sizeof header.magic);
+	get_key (filename, file, & header.size, & header.mtime);
+
+	IndexSave * save = g_slice_new (IndexSave);
+	save->filename = strdup (filename);
+	save->length = sizeof header + sizeof (int64_t) * info->index_fill;
+	save->data = malloc (save->length);
+
+	int64_t * offsets = (int64_t *) (save->data + sizeof header);
+
+	memcpy (save->data, & header, sizeof header);
+	for (size_t i = 0; i < info->index_fill; i ++)
+		offsets[i] = info->index[i];
+
+	pthread_mutex_lock (& save_mutex);
+
+	g_queue_push_tail (& save_queue, save);
+
+	if (! save_running)
+	{
+		pthread_attr_t attr;
+		pthread_t thread;
+
+		pthread_attr_init (& attr);
+		pthread_attr_setdetachstate (& attr, PTHREAD_CREATE_DETACHED);
+
+		if (! pthread_create (& thread, & attr, save_worker, NULL))
+			save_running = TRUE;
+		else
+			index_save_free (g_queue_pop_tail (& save_queue));
+
+		pthread_attr_destroy (& attr);
+	}
+
+	pthread_mutex_unlock (& save_mutex);
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2013 Audacious developers.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef MPG123_CACHE_H
+#define MPG123_CACHE_H
+
+#include <mpg123.h>
+
+#include <libaudcore/vfs.h>
+
+/* What opening (and, with FULL_SCAN, scanning) a file tells us about it.
+ * Adding a file to the playlist probes it, reads its tuple and then plays it,
+ * each time with a decoder of its own; with the results cached, only the first
+ * of these has to open the file with mpg123. */
+typedef struct {
+	long rate;
+	int channels;
+	struct mpg123_frameinfo info;
+	int64_t length; /* in samples, after gapless trimming; -1 if unknown */
+	bool_t scanned; /* length is exact, from mpg123_scan() */
+
+	/* the seek index: the offset of every <index_step>th frame */
+	off_t * index;
+	off_t index_step;
+	size_t index_fill;
+} ScanInfo;
+
+/* Fills <info> from a decoder which has been opened and has read at least one
+ * frame.  The index is copied. */
+void scan_info_from_decoder (ScanInfo * info, mpg123_handle * decoder);
+
+/* Gives a freshly opened decoder the seek index from <info>, so that seeking
+ * does not have to read through the file to find its way. */
+void scan_info_to_decoder (const ScanInfo * info, mpg123_handle * decoder);
+
+void scan_info_clear (ScanInfo * info);
+
+/* Looks for results stored for this file, which must not have changed size or
+ * (for local files) modification time since.  On success, <info> gets its own
+ * copy of the index, to be freed with scan_info_clear(). */
+bool_t scan_cache_lookup (const char * filename, VFSFile * file, ScanInfo * info);
+
+/* Stores results for this file, replacing older ones unless those came from a
+ * full scan or have a seek index covering more of the file. */
+void scan_cache_store (const char * filename, VFSFile * file, const ScanInfo * info);
+
+void scan_cache_cleanup (void);
+
+/* The seek index is also kept on disk, so that seeking in a long VBR file
+ * without a table of contents does not have to read through the file again
+ * each time it is played.  scan_index_load() replaces the index in <info> if
+ * the one on disk covers more of the file, and returns how many frames the one
+ * on disk covers (0 if there is none).  scan_index_save() writes the index in
+ * <info> if it covers more than <saved> frames of a file several minutes long;
+ * the writing is done in the background.  scan_cache_cleanup() waits for it. */
+int64_t scan_index_load (const char * filename, VFSFile * file, ScanInfo * info);
+void scan_index_save (const char * filename, VFSFile * file, const ScanInfo *
+ info, int64_t saved);
+
+#endif
@@ -20,6 +20,7 @@
  */
 
 #include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <mpg123.h>
@@ -33,12 +34,33 @@
 #include <libaudcore/audstrings.h>
 #include <audacious/debug.h>
 #include <audacious/i18n.h>
+#include <audacious/misc.h>
 #include <audacious/plugin.h>
+#include <audacious/plugins.h>
+#include <audacious/preferences.h>
 #include <audacious/audtag.h>
 
+#include "cache.h"
+#include "prefetch/prefetch.h"
+
+/* Entries in the seek index; with more, mpg123 doubles the step between them.
+ * 8192 entries keep the step to a few dozen frames even in a three-hour
+ * mix. */
+#define INDEX_SIZE 8192
+
 /* Define to read all frame headers when calculating file length */
 /* #define FULL_SCAN */
 
+/* the range of rates mpg123's own resampler can convert to */
+#define MIN_RATE 8000
+#define MAX_RATE 96000
+#define RATE_STEP 50
+
+static const char * const mpg123_defaults[] = {
+ "force-rate", "FALSE",
+ "rate", "44100",
+ NULL};
+
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static ssize_t replace_read (void * file, void * buffer, size_t length)
@@ -56,12 +78,19 @@ static off_t replace_lseek_dummy (void * file, off_t to, int whence)
 	return -1;
 }
 
+static void * prime_file (const char * filename);
+static void release_primed (void * primed);
+
+static Prefetcher prefetcher = PREFETCHER (prime_file, release_primed);
+
 /** plugin glue **/
 static bool_t aud_mpg123_init (void)
 {
 	AUDDBG("initializing mpg123 library\n");
 	mpg123_init();
 
+	aud_config_set_defaults ("mpg123", mpg123_defaults);
+
 	return TRUE;
 }
 
@@ -69,6 +98,8 @@ static void
 aud_mpg123_deinit(void)
 {
 	AUDDBG("deinitializing mpg123 library\n");
+	prefetch_cleanup (& prefetcher);
+	scan_cache_cleanup ();
 	mpg123_exit();
 }
 
@@ -78,6 +109,23 @@ static void set_format (mpg123_handle * dec)
 	 44100, 48000};
 
 	mpg123_format_none (dec);
+
+	/* Decoding straight to the output rate saves running a separate sample
+	 * rate converter over the decoded audio afterward. */
+	if (aud_get_bool ("mpg123", "force-rate"))
+	{
+		int rate = aud_get_int ("mpg123", "rate");
+
+		if (mpg123_param (dec, MPG123_FORCE_RATE, rate, 0) == MPG123_OK)
+		{
+			mpg123_format (dec, rate, MPG123_MONO | MPG123_STEREO,
+			 MPG123_ENC_FLOAT_32);
+			return;
+		}
+
+		AUDDBG ("Cannot decode at %d Hz: %s\n", rate, mpg123_strerror (dec));
+	}
+
 	for (int i = 0; i < sizeof rates / sizeof rates[0]; i ++)
 		mpg123_format (dec, rates[i], MPG123_MONO | MPG123_STEREO,
 		 MPG123_ENC_FLOAT_32);
@@ -102,6 +150,14 @@ static bool_t mpg123_probe_for_fd (const char * fname, VFSFile * file)
 		return FALSE;
 
 	bool_t is_streaming = vfs_is_streaming (file);
+	ScanInfo scan;
+
+	/* A file we have opened before was accepted then. */
+	if (scan_cache_lookup (fname, file, & scan))
+	{
+		scan_info_clear (& scan);
+		return TRUE;
+	}
 
 	/* Some MP3s begin with enormous ID3 tags, which fill up the whole probe
 	 * buffer and thus hide any MP3 content.  As a workaround, assume that an
@@ -166,22 +222,27 @@ RETRY:;
 	make_format_string (& info, str, sizeof str);
 	AUDDBG ("Accepted as %s: %s.\n", str, fname);
 
+	/* Save the tuple and the playback from opening the file again. */
+	if (! is_streaming)
+	{
+		scan_info_from_decoder (& scan, dec);
+#ifdef FULL_SCAN
+		scan.scanned = TRUE;
+#endif
+		scan_cache_store (fname, file, & scan);
+		scan_info_clear (& scan);
+	}
+
 	mpg123_delete (dec);
 	return TRUE;
 }
 
-static Tuple * mpg123_probe_for_tuple (const char * filename, VFSFile * file)
+/* Opens the file just far enough to learn its format and length. */
+static bool_t scan_file (const char * filename, VFSFile * file, ScanInfo * scan)
 {
-	if (! file)
-		return NULL;
-
 	bool_t stream = vfs_is_streaming (file);
 	mpg123_handle * decoder = mpg123_new (NULL, NULL);
 	int result;
-	long rate;
-	int channels, encoding;
-	struct mpg123_frameinfo info;
-	char scratch[32];
 
 	mpg123_param (decoder, MPG123_ADD_FLAGS, MPG123_QUIET, 0);
 
@@ -194,29 +255,65 @@ static Tuple * mpg123_probe_for_tuple (const char * filename, VFSFile * file)
 		goto ERR;
 
 #ifdef FULL_SCAN
-	if (mpg123_scan (decoder) < 0)
+	if ((result = mpg123_scan (decoder)) < 0)
 		goto ERR;
 #endif
 
+	long rate;
+	int channels, encoding;
+	struct mpg123_frameinfo info;
+
 	if ((result = mpg123_getformat (decoder, & rate, & channels, & encoding)) <
 	 0)
 		goto ERR;
 	if ((result = mpg123_info (decoder, & info)) < 0)
 		goto ERR;
 
+	scan_info_from_decoder (scan, decoder);
+#ifdef FULL_SCAN
+	scan->scanned = TRUE;
+#endif
+
+	mpg123_delete (decoder);
+	return TRUE;
+
+ERR:
+	fprintf (stderr, "mpg123 probe error for %s: %s\n", filename, mpg123_plain_strerror (result));
+	mpg123_delete (decoder);
+	return FALSE;
+}
+
+static Tuple * mpg123_probe_for_tuple (const char * filename, VFSFile * file)
+{
+	if (! file)
+		return NULL;
+
+	bool_t stream = vfs_is_streaming (file);
+	ScanInfo scan;
+	char scratch[32];
+
+	if (! scan_cache_lookup (filename, file, & scan))
+	{
+		if (! scan_file (filename, file, & scan))
+			return NULL;
+
+		scan_cache_store (filename, file, & scan);
+	}
+
 	Tuple * tuple = tuple_new_from_filename (filename);
-	make_format_string (& info, scratch, sizeof scratch);
+	make_format_string (& scan.info, scratch, sizeof scratch);
 	tuple_set_str (tuple, FIELD_CODEC, NULL, scratch);
-	snprintf (scratch, sizeof scratch, "%s, %d Hz", (channels == 2)
-	 ? _("Stereo") : (channels > 2) ? _("Surround") : _("Mono"), (int) rate);
+	snprintf (scratch, sizeof scratch, "%s, %d Hz", (scan.channels == 2)
+	 ? _("Stereo") : (scan.channels > 2) ? _("Surround") : _("Mono"), (int)
+	 scan.info.rate);
 	tuple_set_str (tuple, FIELD_QUALITY, NULL, scratch);
-	tuple_set_int (tuple, FIELD_BITRATE, NULL, info.bitrate);
+	tuple_set_int (tuple, FIELD_BITRATE, NULL, scan.info.bitrate);
 
 	if (! stream)
 	{
 		int64_t size = vfs_fsize (file);
-		int64_t samples = mpg123_length (decoder);
-		int length = (samples > 0 && rate > 0) ? samples * 1000 / rate : 0;
+		int64_t samples = scan.length;
+		int length = (samples > 0 && scan.rate > 0) ? samples * 1000 / scan.rate : 0;
 
 		if (length > 0)
 			tuple_set_int (tuple, FIELD_LENGTH, NULL, length);
@@ -224,17 +321,12 @@ static Tuple * mpg123_probe_for_tuple (const char * filename, VFSFile * file)
 			tuple_set_int (tuple, FIELD_BITRATE, NULL, 8 * size / length);
 	}
 
-	mpg123_delete (decoder);
+	scan_info_clear (& scan);
 
 	if (! stream && ! vfs_fseek (file, 0, SEEK_SET))
 		tag_tuple_read (tuple, file);
 
 	return tuple;
-
-ERR:
-	fprintf (stderr, "mpg123 probe error for %s: %s\n", filename, mpg123_plain_strerror (result));
-	mpg123_delete (decoder);
-	return NULL;
 }
 
 typedef struct {
@@ -301,6 +393,111 @@ static void update_stream_tuple (InputPlayback * p, VFSFile * file,
 	}
 }
 
+/* A decoder opened on a file and primed with its first block of audio, ready
+ * to play. */
+typedef struct {
+	VFSFile * file; /* only if opened for prefetching */
+	mpg123_handle * decoder;
+	ScanInfo scan;
+	int64_t index_saved;
+	long rate;
+	int channels, encoding;
+	float buf[8192];
+	size_t buf_size;
+} Primed;
+
+static void primed_free (Primed * primed)
+{
+	if (primed->decoder)
+		mpg123_delete (primed->decoder);
+	if (primed->file)
+		vfs_fclose (primed->file);
+
+	scan_info_clear (& primed->scan);
+	free (primed);
+}
+
+/* On failure, the decoder is left open so that the caller can report the error
+ * from it. */
+static bool_t prime_decoder (Primed * primed, const char * filename, VFSFile *
+ file, bool_t stream)
+{
+	int ret;
+
+	primed->decoder = mpg123_new (NULL, NULL);
+	mpg123_param (primed->decoder, MPG123_ADD_FLAGS, MPG123_QUIET, 0);
+	mpg123_param (primed->decoder, MPG123_ADD_FLAGS, MPG123_GAPLESS, 0);
+	mpg123_param (primed->decoder, MPG123_ADD_FLAGS, MPG123_SEEKBUFFER, 0);
+	mpg123_param (primed->decoder, MPG123_INDEX_SIZE, INDEX_SIZE, 0);
+
+	if (stream)
+		mpg123_replace_reader_handle (primed->decoder, replace_read, replace_lseek_dummy, NULL);
+	else
+		mpg123_replace_reader_handle (primed->decoder, replace_read, replace_lseek, NULL);
+
+	set_format (primed->decoder);
+
+	if (mpg123_open_handle (primed->decoder, file) < 0)
+		return FALSE;
+
+	if (! stream)
+	{
+		scan_cache_lookup (filename, file, & primed->scan);
+		primed->index_saved = scan_index_load (filename, file, & primed->scan);
+		scan_info_to_decoder (& primed->scan, primed->decoder);
+	}
+
+#ifdef FULL_SCAN
+	if (! primed->scan.scanned && mpg123_scan (primed->decoder) < 0)
+		return FALSE;
+
+	primed->scan.scanned = TRUE;
+#endif
+
+GET_FORMAT:
+	if (mpg123_getformat (primed->decoder, & primed->rate, & primed->channels,
+	 & primed->encoding) < 0)
+		return FALSE;
+
+	while ((ret = mpg123_read (primed->decoder, (void *) primed->buf, sizeof
+	 primed->buf, & primed->buf_size)) < 0)
+	{
+		if (ret == MPG123_NEW_FORMAT)
+			goto GET_FORMAT;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void * prime_file (const char * filename)
+{
+	Primed * primed = calloc (1, sizeof (Primed));
+
+	if (! (primed->file = vfs_fopen (filename, "r")) || vfs_is_streaming
+	 (primed->file) || ! prime_decoder (primed, filename, primed->file, FALSE))
+	{
+		primed_free (primed);
+		return NULL;
+	}
+
+	return primed;
+}
+
+static void release_primed (void * primed)
+{
+	primed_free (primed);
+}
+
+/* Opening an MP3 costs a few reads scattered over the file (more with
+ * FULL_SCAN), so the next track is primed while this one plays. */
+static void start_prefetch (const char * filename)
+{
+	extern InputPlugin _aud_plugin_self;
+	prefetch_next (& prefetcher, aud_plugin_by_header (& _aud_plugin_self),
+	 filename);
+}
+
 static bool_t mpg123_playback_worker (InputPlayback * data, const char *
  filename, VFSFile * file, int start_time, int stop_time, bool_t pause)
 {
@@ -329,19 +526,39 @@ static bool_t mpg123_playback_worker (InputPlayback * data, const char *
 	ctx.stop = FALSE;
 	data->set_data (data, & ctx);
 
-	ctx.decoder = mpg123_new (NULL, NULL);
-	mpg123_param (ctx.decoder, MPG123_ADD_FLAGS, MPG123_QUIET, 0);
-	mpg123_param (ctx.decoder, MPG123_ADD_FLAGS, MPG123_GAPLESS, 0);
-	mpg123_param (ctx.decoder, MPG123_ADD_FLAGS, MPG123_SEEKBUFFER, 0);
+	Primed * primed = ctx.stream ? NULL : prefetch_take (& prefetcher, filename);
+
+	/* The file may have been changed since. */
+	if (primed && vfs_fsize (primed->file) != vfs_fsize (file))
+	{
+		primed_free (primed);
+		primed = NULL;
+	}
 
-	if (ctx.stream)
-		mpg123_replace_reader_handle (ctx.decoder, replace_read, replace_lseek_dummy, NULL);
+	if (primed)
+		AUDDBG ("Using prefetched decoder.\n");
 	else
-		mpg123_replace_reader_handle (ctx.decoder, replace_read, replace_lseek, NULL);
+	{
+		primed = calloc (1, sizeof (Primed));
 
-	set_format (ctx.decoder);
+		if (! prime_decoder (primed, filename, file, ctx.stream))
+		{
+			ctx.decoder = primed->decoder;
+			goto OPEN_ERROR;
+		}
+	}
+
+	ctx.decoder = primed->decoder;
+	ctx.rate = primed->rate;
+	ctx.channels = primed->channels;
+	ctx.encoding = primed->encoding;
+
+	float outbuf[8192];
+	size_t outbuf_size = primed->buf_size;
+
+	memcpy (outbuf, primed->buf, outbuf_size);
 
-	if (mpg123_open_handle (ctx.decoder, file) < 0)
+	if (mpg123_info (ctx.decoder, & fi) < 0)
 	{
 OPEN_ERROR:
 		fprintf (stderr, "mpg123: Error opening %s: %s.\n", filename,
@@ -350,30 +567,6 @@ OPEN_ERROR:
 		goto cleanup;
 	}
 
-	float outbuf[8192];
-	size_t outbuf_size = 0;
-
-#ifdef FULL_SCAN
-	if (mpg123_scan (ctx.decoder) < 0)
-		goto OPEN_ERROR;
-#endif
-
-GET_FORMAT:
-	if (mpg123_getformat (ctx.decoder, & ctx.rate, & ctx.channels,
-	 & ctx.encoding) < 0)
-		goto OPEN_ERROR;
-
-	while ((ret = mpg123_read (ctx.decoder, (void *) outbuf, sizeof outbuf,
-	 & outbuf_size)) < 0)
-	{
-		if (ret == MPG123_NEW_FORMAT)
-			goto GET_FORMAT;
-		goto OPEN_ERROR;
-	}
-
-	if (mpg123_info (ctx.decoder, & fi) < 0)
-		goto OPEN_ERROR;
-
 	bitrate = fi.bitrate * 1000;
 	data->set_params (data, bitrate, ctx.rate, ctx.channels);
 
@@ -397,6 +590,8 @@ GET_FORMAT:
 
 	pthread_mutex_unlock (& mutex);
 
+	start_prefetch (filename);
+
 	int64_t frames_played = 0;
 	int64_t frames_total = (int64_t) (stop_time - start_time) * ctx.rate / 1000;
 
@@ -495,8 +690,20 @@ decode_cleanup:
 	data->set_data (data, NULL);
 	pthread_mutex_unlock (& mutex);
 
+	/* By now the seek index covers as much of the file as was played. */
+	if (! ctx.stream)
+	{
+		bool_t scanned = primed->scan.scanned;
+
+		scan_info_clear (& primed->scan);
+		scan_info_from_decoder (& primed->scan, ctx.decoder);
+		primed->scan.scanned = scanned;
+		scan_cache_store (filename, file, & primed->scan);
+		scan_index_save (filename, file, & primed->scan, primed->index_saved);
+	}
+
 cleanup:
-	mpg123_delete(ctx.decoder);
+	primed_free (primed);
 	if (ctx.tu)
 		tuple_unref (ctx.tu);
 	return ! error;
@@ -558,6 +765,19 @@ static bool_t mpg123_get_image (const char * filename, VFSFile * handle,
 	return tag_image_read (handle, data, length);
 }
 
+static const PreferencesWidget mpg123_widgets[] = {
+ {WIDGET_LABEL, N_("<b>Output</b>")},
+ {WIDGET_CHK_BTN, N_("Resample while decoding"),
+  .cfg_type = VALUE_BOOLEAN, .csect = "mpg123", .cname = "force-rate"},
+ {WIDGET_SPIN_BTN, N_("Rate:"), .child = TRUE,
+  .cfg_type = VALUE_INT, .csect = "mpg123", .cname = "rate",
+  .data = {.spin_btn = {MIN_RATE, MAX_RATE, RATE_STEP, N_("Hz")}}},
+ {WIDGET_LABEL, N_("Changes take effect at the next song change.")}};
+
+static const PluginPreferences mpg123_prefs = {
+ .widgets = mpg123_widgets,
+ .n_widgets = sizeof mpg123_widgets / sizeof mpg123_widgets[0]};
+
 /** plugin description header **/
 static const char *mpg123_fmts[] = { "mp3", "mp2", "mp1", "bmu", NULL };
 
@@ -567,6 +787,7 @@ AUD_INPUT_PLUGIN
 	.domain = PACKAGE,
 	.init = aud_mpg123_init,
 	.cleanup = aud_mpg123_deinit,
+	.prefs = & mpg123_prefs,
 	.extensions = mpg123_fmts,
 	.is_our_file_from_vfs = mpg123_probe_for_fd,
 	.probe_for_tuple = mpg123_probe_for_tuple,
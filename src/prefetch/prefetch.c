@@ -0,0 +1,193 @@
+/*
+ * Next-Track Prefetching for Audacious Input Plugins
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <audacious/debug.h>
+#include <audacious/misc.h>
+#include <audacious/playlist.h>
+#include <audacious/plugin.h>
+#include <libaudcore/audstrings.h>
+
+#include "prefetch.h"
+
+typedef struct {
+    Prefetcher * pf;
+    PluginHandle * self;
+    char * filename;
+} Job;
+
+/* Called with the mutex locked. */
+static void discard (Prefetcher * pf)
+{
+    if (pf->primed)
+    {
+        pf->release (pf->primed);
+        pf->primed = NULL;
+    }
+
+    free (pf->primed_name);
+    pf->primed_name = NULL;
+}
+
+static void * prime_worker (void * data)
+{
+    Job * job = data;
+    Prefetcher * pf = job->pf;
+    void * primed = NULL;
+
+    /* Matching by contents may open the file, so it is done here. */
+    if (aud_file_find_decoder (job->filename, FALSE) == job->self &&
+     ! (primed = pf->prime (job->filename)))
+        AUDDBG ("Cannot prefetch %s.\n", job->filename);
+
+    pthread_mutex_lock (& pf->mutex);
+
+    /* The playlist may have changed meanwhile. */
+    if (primed && pf->wanted && ! strcmp (pf->wanted, job->filename))
+    {
+        discard (pf);
+        pf->primed = primed;
+        pf->primed_name = job->filename;
+        job->filename = NULL;
+    }
+    else if (primed)
+        pf->release (primed);
+
+    pf->running --;
+    pthread_cond_broadcast (& pf->cond);
+    pthread_mutex_unlock (& pf->mutex);
+
+    free (job->filename);
+    free (job);
+    return NULL;
+}
+
+void prefetch_next (Prefetcher * pf, PluginHandle * self, const char * filename)
+{
+    if (aud_get_bool (NULL, "shuffle"))
+        return;
+
+    int playlist = aud_playlist_get_playing ();
+    if (playlist < 0)
+        return;
+
+    int pos = aud_playlist_get_position (playlist);
+    if (pos < 0 || pos + 1 >= aud_playlist_entry_count (playlist))
+        return;
+
+    char * current = aud_playlist_entry_get_filename (playlist, pos);
+    char * next = aud_playlist_entry_get_filename (playlist, pos + 1);
+
+    /* Two entries from one file (as in a cue sheet) need nothing primed.  Only
+     * local files are primed, so that nothing is opened over the network. */
+    if (! current || ! next || strcmp (current, filename) || ! strcmp (next,
+     filename) || strncmp (next, "file://", 7))
+        goto DONE;
+
+    pthread_mutex_lock (& pf->mutex);
+
+    if (! pf->wanted || strcmp (pf->wanted, next))
+    {
+        discard (pf);
+        free (pf->wanted);
+        pf->wanted = strdup (next);
+
+        Job * job = malloc (sizeof (Job));
+        job->pf = pf;
+        job->self = self;
+        job->filename = strdup (next);
+
+        pthread_t thread;
+
+        if (! pthread_create (& thread, NULL, prime_worker, job))
+        {
+            pthread_detach (thread);
+            pf->running ++;
+        }
+        else
+        {
+            free (job->filename);
+            free (job);
+        }
+    }
+
+    pthread_mutex_unlock (& pf->mutex);
+
+DONE:
+    str_unref (current);
+    str_unref (next);
+}
+
+/* Returns TRUE if <filename> is the playing entry in the playing playlist. */
+static bool_t is_playing (const char * filename)
+{
+    int playlist = aud_playlist_get_playing ();
+    if (playlist < 0)
+        return FALSE;
+
+    int pos = aud_playlist_get_position (playlist);
+    if (pos < 0)
+        return FALSE;
+
+    char * current = aud_playlist_entry_get_filename (playlist, pos);
+    bool_t playing = (current && ! strcmp (current, filename));
+
+    str_unref (current);
+    return playing;
+}
+
+void * prefetch_take (Prefetcher * pf, const char * filename)
+{
+    void * primed = NULL;
+
+    if (! is_playing (filename))
+        return NULL;
+
+    pthread_mutex_lock (& pf->mutex);
+
+    if (pf->primed && ! strcmp (pf->primed_name, filename))
+    {
+        primed = pf->primed;
+        pf->primed = NULL;
+        discard (pf);
+
+        free (pf->wanted);
+        pf->wanted = NULL;
+    }
+
+    pthread_mutex_unlock (& pf->mutex);
+
+    return primed;
+}
+
+void prefetch_cleanup (Prefetcher * pf)
+{
+    pthread_mutex_lock (& pf->mutex);
+
+    discard (pf);
+    free (pf->wanted);
+    pf->wanted = NULL; /* the threads will throw their results away */
+
+    while (pf->running)
+        pthread_cond_wait (& pf->cond, & pf->mutex);
+
+    pthread_mutex_unlock (& pf->mutex);
+}
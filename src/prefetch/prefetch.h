@@ -0,0 +1,73 @@
+/*
+ * Next-Track Prefetching for Audacious Input Plugins
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef AUD_PREFETCH_H
+#define AUD_PREFETCH_H
+
+#include <pthread.h>
+
+#include <audacious/types.h>
+
+/* Gapless playback of an album means starting each track the moment the one
+ * before it ends.  Opening a file can take a number of reads scattered over it
+ * and some probing, which on slow storage is enough to be heard, so while one
+ * track plays, an input plugin can have the next one in the playlist opened
+ * and primed on a thread of its own, ready to be handed over when the player
+ * gets to it.
+ *
+ * The plugin supplies <prime>, which opens a file and gets it ready to play (or
+ * returns NULL), and <release>, which closes what <prime> returned.  Only the
+ * plugin knows what a primed file looks like; here it is only passed around.
+ * Each plugin has one Prefetcher, set up with PREFETCHER(). */
+
+typedef struct {
+    void * (* prime) (const char * filename);
+    void (* release) (void * primed);
+
+    /* the rest is private */
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    char * wanted; /* the next track, being or having been primed */
+    char * primed_name;
+    void * primed;
+    int running; /* threads not yet finished */
+} Prefetcher;
+
+#define PREFETCHER(prime, release) {prime, release, \
+ PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER}
+
+/* To be called once <filename> has started playing, by a plugin whose handle
+ * is <self>.  If <filename> is the playing entry in the playing playlist, and
+ * the entry after it is a local file which would also be played by this
+ * plugin, starts priming that one.  Anything primed earlier for a different
+ * next entry is thrown away.  Nothing is done with shuffle on, since the next
+ * entry is not known. */
+void prefetch_next (Prefetcher * pf, PluginHandle * self, const char * filename);
+
+/* Hands over what was primed for <filename>, if it is ready and <filename> is
+ * the playing entry in the playing playlist, so that only the player gets it.
+ * Returns NULL otherwise, or if it is still being primed; the caller should
+ * then open the file itself rather than wait.  A call for some other file (not
+ * from the player, for instance) leaves the next track alone. */
+void * prefetch_take (Prefetcher * pf, const char * filename);
+
+/* Throws away anything primed and waits for priming threads to finish. */
+void prefetch_cleanup (Prefetcher * pf);
+
+#endif
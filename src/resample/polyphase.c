@@ -0,0 +1,236 @@
+/*
+ * Polyphase Resampler for the Sample Rate Converter Plugin
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "polyphase.h"
+
+/* The largest number of coefficients we are willing to precompute.  This
+ * covers every ratio between the common rates from 8 to 192 kHz except a few
+ * oddities like 8 kHz to 44.1 kHz, which are left to libsamplerate. */
+#define MAX_COEFS 65536
+
+/* Input is fed through the filter in chunks of at most this many frames, so
+ * that the history buffer can be allocated once up front. */
+#define CHUNK 4096
+
+struct Polyphase {
+    int up, down, channels;
+    int taps; /* coefficients per phase */
+    float * coefs; /* [phase][tap], taps in order of increasing input time */
+    float * history; /* (taps - 1 + CHUNK) frames */
+    int filled; /* frames in history */
+    int pos; /* first history frame used for the next output frame */
+    int phase;
+};
+
+static int gcd (int a, int b)
+{
+    while (b)
+    {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+static double bessel_i0 (double x)
+{
+    double sum = 1, term = 1;
+
+    for (int k = 1; k < 50 && term > sum * 1e-12; k ++)
+    {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+
+    return sum;
+}
+
+/* Designs a Kaiser-windowed sinc lowpass filter at <up> times the input rate
+ * and splits it into <up> phases. */
+static void design_filter (Polyphase * p, int lower_taps, double atten)
+{
+    int up = p->up;
+    int n = up * p->taps;
+    int wider = (p->up > p->down) ? p->up : p->down;
+
+    /* Put the stopband edge at the Nyquist frequency of the lower rate, with
+     * the transition band as narrow as the filter length allows. */
+    double transition = (atten - 8) / (14.36 * lower_taps);
+    double cutoff = (0.5 - transition / 2) / wider;
+    double beta = (atten > 50) ? 0.1102 * (atten - 8.7) :
+     0.5842 * pow (atten - 21, 0.4) + 0.07886 * (atten - 21);
+    double center = (n - 1) / 2.0;
+    double norm = bessel_i0 (beta);
+
+    for (int i = 0; i < n; i ++)
+    {
+        double x = i - center;
+        double r = x / (center + 0.5);
+        double window = bessel_i0 (beta * sqrt (1 - r * r)) / norm;
+        double sinc = (x == 0) ? 1 : sin (2 * M_PI * cutoff * x) / (2 * M_PI * cutoff * x);
+        double h = up * 2 * cutoff * sinc * window;
+
+        /* Coefficient i multiplies input frame (pos + taps - 1 - i / up) when
+         * computing phase i % up. */
+        int phase = i % up;
+        int tap = p->taps - 1 - i / up;
+        p->coefs[phase * p->taps + tap] = h;
+    }
+}
+
+Polyphase * polyphase_new (int in_rate, int out_rate, int channels, int taps,
+ double atten)
+{
+    int div = gcd (in_rate, out_rate);
+    int up = out_rate / div;
+    int down = in_rate / div;
+    int wider = (up > down) ? up : down;
+
+    /* Measured at the input rate, the filter must be longer when reducing the
+     * rate, since its length is given in periods of the (lower) output rate. */
+    int phase_taps = ((int64_t) taps * wider + up - 1) / up;
+
+    if ((int64_t) up * phase_taps > MAX_COEFS)
+        return NULL;
+
+    Polyphase * p = malloc (sizeof (Polyphase));
+    p->up = up;
+    p->down = down;
+    p->channels = channels;
+    p->taps = phase_taps;
+    p->coefs = malloc (sizeof (float) * up * phase_taps);
+    p->history = malloc (sizeof (float) * channels * (phase_taps - 1 + CHUNK));
+
+    design_filter (p, taps, atten);
+    polyphase_reset (p);
+
+    return p;
+}
+
+void polyphase_free (Polyphase * p)
+{
+    free (p->coefs);
+    free (p->history);
+    free (p);
+}
+
+void polyphase_reset (Polyphase * p)
+{
+    /* Start with the filter full of silence. */
+    memset (p->history, 0, sizeof (float) * p->channels * (p->taps - 1));
+    p->filled = p->taps - 1;
+    p->pos = 0;
+    p->phase = 0;
+}
+
+int polyphase_max_output (Polyphase * p, int frames)
+{
+    /* The flushed tail is half the filter length. */
+    frames += p->taps / 2 + 1;
+    return (int64_t) frames * p->up / p->down + 1;
+}
+
+static int run_filter (Polyphase * p, float * out)
+{
+    int channels = p->channels;
+    int taps = p->taps;
+    int written = 0;
+
+    while (p->pos + taps <= p->filled)
+    {
+        const float * coef = p->coefs + p->phase * taps;
+        const float * get = p->history + channels * p->pos;
+
+        for (int c = 0; c < channels; c ++)
+            out[c] = 0;
+
+        for (int t = 0; t < taps; t ++)
+        {
+            for (int c = 0; c < channels; c ++)
+                out[c] += get[c] * coef[t];
+
+            get += channels;
+        }
+
+        out += channels;
+        written ++;
+
+        p->phase += p->down;
+        p->pos += p->phase / p->up;
+        p->phase %= p->up;
+    }
+
+    /* Keep only the frames still needed for the next output frame. */
+    int keep = p->filled - p->pos;
+
+    if (keep > 0)
+        memmove (p->history, p->history + channels * p->pos,
+         sizeof (float) * channels * keep);
+
+    p->filled = (keep > 0) ? keep : 0;
+    p->pos = (keep > 0) ? 0 : -keep;
+
+    return written;
+}
+
+static int feed (Polyphase * p, const float * in, int frames, float * out)
+{
+    int written = 0;
+
+    while (frames > 0)
+    {
+        int chunk = (frames < CHUNK) ? frames : CHUNK;
+
+        if (in)
+            memcpy (p->history + p->channels * p->filled, in,
+             sizeof (float) * p->channels * chunk);
+        else
+            memset (p->history + p->channels * p->filled, 0,
+             sizeof (float) * p->channels * chunk);
+
+        p->filled += chunk;
+        written += run_filter (p, out + p->channels * written);
+
+        if (in)
+            in += p->channels * chunk;
+
+        frames -= chunk;
+    }
+
+    return written;
+}
+
+int polyphase_process (Polyphase * p, const float * in, int frames,
+ float * out, int finish)
+{
+    int written = feed (p, in, frames, out);
+
+    /* Push the last of the input through the filter with silence. */
+    if (finish)
+        written += feed (p, NULL, p->taps / 2, out + p->channels * written);
+
+    return written;
+}
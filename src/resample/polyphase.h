@@ -0,0 +1,49 @@
+/*
+ * Polyphase Resampler for the Sample Rate Converter Plugin
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef AUD_RESAMPLE_POLYPHASE_H
+#define AUD_RESAMPLE_POLYPHASE_H
+
+/* A polyphase FIR resampler for rates whose ratio reduces to a simple fraction,
+ * such as 2:1, 1:2, or 160:147 (44.1 to 48 kHz).  For these, all the filter
+ * coefficients needed can be worked out in advance, so each output sample is a
+ * single dot product with no interpolation of the filter. */
+
+typedef struct Polyphase Polyphase;
+
+/* Returns NULL if the ratio between the two rates is too complex to be
+ * handled this way.  <taps> is the filter length, measured in periods of the
+ * lower of the two rates, and <atten> is the stopband attenuation in dB. */
+Polyphase * polyphase_new (int in_rate, int out_rate, int channels, int taps,
+ double atten);
+void polyphase_free (Polyphase * p);
+
+/* Returns the largest number of frames polyphase_process() can produce from
+ * <frames> frames of input, including the tail flushed at the end. */
+int polyphase_max_output (Polyphase * p, int frames);
+
+/* Resamples <frames> frames from <in> into <out> and returns the number of
+ * frames written.  If <finish> is set, the audio still held in the filter is
+ * flushed out as well. */
+int polyphase_process (Polyphase * p, const float * in, int frames,
+ float * out, int finish);
+
+void polyphase_reset (Polyphase * p);
+
+#endif
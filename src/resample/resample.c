@@ -27,16 +27,37 @@
 #include <audacious/plugin.h>
 #include <audacious/preferences.h>
 
+#include "dsp/dsp.h"
+#include "polyphase.h"
+
 #define MIN_RATE 8000
 #define MAX_RATE 192000
 #define RATE_STEP 50
+#define MAX_THREADS 8
+
+/* The output buffer is allocated at start for blocks of up to this length and
+ * only grows if a longer one arrives. */
+#define BLOCK_TIME 500 /* ms */
 
 #define RESAMPLE_ERROR(e) fprintf (stderr, "resample: %s\n", src_strerror (e))
 
+/* Filter length (in periods of the lower rate) and stopband attenuation used by
+ * the polyphase resampler in place of each of the libsamplerate sinc methods.
+ * The simpler libsamplerate methods are cheap enough as they are. */
+static const struct {
+    int taps;
+    double atten;
+} polyphase_quality[] = {
+ {192, 120}, /* SRC_SINC_BEST_QUALITY */
+ {128, 100}, /* SRC_SINC_MEDIUM_QUALITY */
+ {64, 80}}; /* SRC_SINC_FASTEST */
+
 static const char * const resample_defaults[] = {
  "method", "2", /* SRC_SINC_FASTEST */
  "default-rate", "44100",
  "use-mappings", "FALSE",
+ "use-polyphase", "TRUE",
+ "threads", "1",
  "8000", "48000",
  "16000", "48000",
  "22050", "44100",
@@ -47,25 +68,139 @@ static const char * const resample_defaults[] = {
  NULL};
 
 static SRC_STATE * state;
+static Polyphase * polyphase;
 static int stored_channels;
 static double ratio;
 static float * buffer;
 static int buffer_samples;
 
+/* With more than two channels, each channel can instead be given a polyphase
+ * filter of its own and the channels resampled side by side on worker threads.
+ * Each lane sees exactly the input a single filter would have, and its output
+ * is bit-identical, so it does not depend on the number of threads.  This is
+ * not done for libsamplerate, which handles the channels of a multichannel
+ * converter together and is not known to give the same output per channel. */
+typedef struct {
+    Polyphase * polyphase;
+    float * in, * out;
+    int out_frames;
+} Lane;
+
+static Lane * lanes;
+static int lane_in_frames, lane_out_frames;
+static DSPWorkers * workers;
+
+typedef struct {
+    int frames;
+    bool_t finish;
+} LaneJob;
+
 bool_t resample_init (void)
 {
     aud_config_set_defaults ("resample", resample_defaults);
     return TRUE;
 }
 
-void resample_cleanup (void)
+static void enlarge_buffer (int samples)
 {
+    if (buffer_samples < samples)
+    {
+        buffer_samples = samples;
+        buffer = realloc (buffer, sizeof (float) * buffer_samples);
+    }
+}
+
+static void enlarge_lanes (int in_frames, int out_frames)
+{
+    if (lane_in_frames < in_frames)
+    {
+        lane_in_frames = in_frames;
+
+        for (int c = 0; c < stored_channels; c ++)
+            lanes[c].in = realloc (lanes[c].in, sizeof (float) * in_frames);
+    }
+
+    if (lane_out_frames < out_frames)
+    {
+        lane_out_frames = out_frames;
+
+        for (int c = 0; c < stored_channels; c ++)
+            lanes[c].out = realloc (lanes[c].out, sizeof (float) * out_frames);
+    }
+}
+
+static void close_lanes (void)
+{
+    if (! lanes)
+        return;
+
+    for (int c = 0; c < stored_channels; c ++)
+    {
+        if (lanes[c].polyphase)
+            polyphase_free (lanes[c].polyphase);
+
+        free (lanes[c].in);
+        free (lanes[c].out);
+    }
+
+    free (lanes);
+    lanes = NULL;
+    lane_in_frames = lane_out_frames = 0;
+
+    if (workers)
+    {
+        dsp_workers_free (workers);
+        workers = NULL;
+    }
+}
+
+/* Sets up one mono polyphase filter for each channel.  Falls back to a single
+ * converter if the rates are not in a simple ratio. */
+static bool_t open_lanes (int channels, int in_rate, int out_rate, int method)
+{
+    if (! aud_get_bool ("resample", "use-polyphase") || method < 0 || method >=
+     (int) (sizeof polyphase_quality / sizeof polyphase_quality[0]))
+        return FALSE;
+
+    lanes = calloc (channels, sizeof (Lane));
+    stored_channels = channels;
+
+    for (int c = 0; c < channels; c ++)
+    {
+        if (! (lanes[c].polyphase = polyphase_new (in_rate, out_rate, 1,
+         polyphase_quality[method].taps, polyphase_quality[method].atten)))
+        {
+            close_lanes ();
+            return FALSE;
+        }
+    }
+
+    int threads = aud_get_int ("resample", "threads");
+    workers = dsp_workers_new (CLAMP (threads, 1, MIN (channels, MAX_THREADS)));
+    return TRUE;
+}
+
+static void close_converter (void)
+{
+    close_lanes ();
+
     if (state)
     {
         src_delete (state);
         state = NULL;
     }
 
+    if (polyphase)
+    {
+        polyphase_free (polyphase);
+        polyphase = NULL;
+    }
+}
+
+void resample_cleanup (void)
+{
+    close_converter ();
+
     free (buffer);
     buffer = NULL;
     buffer_samples = 0;
@@ -73,11 +208,7 @@ void resample_cleanup (void)
 
 void resample_start (int * channels, int * rate)
 {
-    if (state)
-    {
-        src_delete (state);
-        state = NULL;
-    }
+    close_converter ();
 
     int new_rate = 0;
 
@@ -96,30 +227,115 @@ void resample_start (int * channels, int * rate)
         return;
 
     int method = aud_get_int ("resample", "method");
-    int error;
 
-    if ((state = src_new (method, * channels, & error)) == NULL)
+    if (* channels > 2 && aud_get_int ("resample", "threads") > 1 &&
+     open_lanes (* channels, * rate, new_rate, method))
     {
-        RESAMPLE_ERROR (error);
+        ratio = (double) new_rate / * rate;
+        * rate = new_rate;
+
+        int block = (int) ((int64_t) new_rate * BLOCK_TIME / 1000);
+        enlarge_lanes ((int) (block / ratio) + 1, block + 256);
+        enlarge_buffer (* channels * (block + 256));
         return;
     }
 
+    /* When the two rates are in a simple ratio, such as 2:1 or 160:147, a
+     * polyphase filter with precomputed coefficients does the same job much
+     * more cheaply than libsamplerate's general interpolator. */
+    if (aud_get_bool ("resample", "use-polyphase") && method >= 0 && method <
+     (int) (sizeof polyphase_quality / sizeof polyphase_quality[0]))
+        polyphase = polyphase_new (* rate, new_rate, * channels,
+         polyphase_quality[method].taps, polyphase_quality[method].atten);
+
+    if (! polyphase)
+    {
+        int error;
+
+        if ((state = src_new (method, * channels, & error)) == NULL)
+        {
+            RESAMPLE_ERROR (error);
+            return;
+        }
+    }
+
     stored_channels = * channels;
     ratio = (double) new_rate / * rate;
     * rate = new_rate;
+
+    int block = * channels * (int) ((int64_t) new_rate * BLOCK_TIME / 1000);
+    enlarge_buffer (block + 256);
+}
+
+static void run_lane (void * data, int c)
+{
+    LaneJob * job = data;
+    Lane * lane = & lanes[c];
+
+    lane->out_frames = polyphase_process (lane->polyphase, lane->in,
+     job->frames, lane->out, job->finish);
+}
+
+static void resample_lanes (float * * data, int * samples, bool_t finish)
+{
+    int channels = stored_channels;
+    LaneJob job = {* samples / channels, finish};
+
+    enlarge_lanes (job.frames, polyphase_max_output (lanes[0].polyphase,
+     job.frames));
+
+    const float * in = * data;
+
+    for (int c = 0; c < channels; c ++)
+    {
+        for (int f = 0; f < job.frames; f ++)
+            lanes[c].in[f] = in[channels * f + c];
+    }
+
+    dsp_workers_run (workers, run_lane, & job, channels);
+
+    /* every lane should produce the same number of frames */
+    int frames = lanes[0].out_frames;
+    for (int c = 1; c < channels; c ++)
+        frames = MIN (frames, lanes[c].out_frames);
+
+    enlarge_buffer (channels * frames);
+
+    for (int c = 0; c < channels; c ++)
+    {
+        for (int f = 0; f < frames; f ++)
+            buffer[channels * f + c] = lanes[c].out[f];
+    }
+
+    * data = buffer;
+    * samples = channels * frames;
 }
 
 void do_resample (float * * data, int * samples, bool_t finish)
 {
-    if (! state || ! * samples)
+    if (lanes)
+    {
+        resample_lanes (data, samples, finish);
         return;
+    }
 
-    if (buffer_samples < (int) (* samples * ratio) + 256)
+    if (polyphase)
     {
-        buffer_samples = (int) (* samples * ratio) + 256;
-        buffer = realloc (buffer, sizeof (float) * buffer_samples);
+        int frames = * samples / stored_channels;
+
+        enlarge_buffer (stored_channels * polyphase_max_output (polyphase, frames));
+        frames = polyphase_process (polyphase, * data, frames, buffer, finish);
+
+        * data = buffer;
+        * samples = stored_channels * frames;
+        return;
     }
 
+    if (! state || ! * samples)
+        return;
+
+    enlarge_buffer ((int) (* samples * ratio) + 256);
+
     SRC_DATA d = {
      .data_in = * data,
      .input_frames = * samples / stored_channels,
@@ -146,6 +362,12 @@ void resample_process (float * * data, int * samples)
 
 void resample_flush (void)
 {
+    for (int c = 0; lanes && c < stored_channels; c ++)
+        polyphase_reset (lanes[c].polyphase);
+
+    if (polyphase)
+        polyphase_reset (polyphase);
+
     int error;
     if (state && (error = src_reset (state)))
         RESAMPLE_ERROR (error);
@@ -176,6 +398,11 @@ static const PreferencesWidget resample_widgets[] = {
  {WIDGET_SPIN_BTN, N_("Rate:"),
   .cfg_type = VALUE_INT, .csect = "resample", .cname = "default-rate",
   .data = {.spin_btn = {MIN_RATE, MAX_RATE, RATE_STEP, N_("Hz")}}},
+ {WIDGET_CHK_BTN, N_("Use faster filters for simple ratios (e.g. 48 to 96 kHz)"),
+  .cfg_type = VALUE_BOOLEAN, .csect = "resample", .cname = "use-polyphase"},
+ {WIDGET_SPIN_BTN, N_("Threads for surround sound:"),
+  .cfg_type = VALUE_INT, .csect = "resample", .cname = "threads",
+  .data = {.spin_btn = {1, MAX_THREADS, 1}}},
  {WIDGET_LABEL, N_("<b>Rate Mappings</b>")},
  {WIDGET_CHK_BTN, N_("Use rate mappings"),
   .cfg_type = VALUE_BOOLEAN, .csect = "resample", .cname = "use-mappings"},
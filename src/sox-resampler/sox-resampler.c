@@ -33,17 +33,19 @@
 #define MIN_RATE 8000
 #define MAX_RATE 192000
 #define RATE_STEP 50
+#define MAX_THREADS 8
 
 #define RESAMPLER_ERROR(e) fprintf (stderr, "sox-resampler: %s\n", e)
 
 static const char * const sox_resampler_defaults[] = {
  "quality", "4", /* SOXR_HQ */
  "rate", "44100",
+ "threads", "1",
  NULL};
 
 static soxr_t soxr;
 static soxr_error_t error;
-static int stored_channels;
+static int stored_channels, stored_rate;
 static double ratio;
 static float * buffer;
 static size_t buffer_samples;
@@ -76,7 +78,12 @@ void sox_resampler_start (int * channels, int * rate)
 
     soxr_quality_spec_t q = soxr_quality_spec(aud_get_int ("soxr", "quality"), 0);
 
-    soxr = soxr_create((double) * rate, (double) new_rate, * channels, & error, NULL, & q, NULL);
+    /* libsoxr splits multichannel audio by channel across its own threads;
+     * each channel is still resampled the same way, only in parallel. */
+    int threads = (* channels > 2) ? aud_get_int ("soxr", "threads") : 1;
+    soxr_runtime_spec_t r = soxr_runtime_spec (CLAMP (threads, 1, MAX_THREADS));
+
+    soxr = soxr_create((double) * rate, (double) new_rate, * channels, & error, NULL, & q, & r);
 
     if (error)
     {
@@ -85,25 +92,31 @@ void sox_resampler_start (int * channels, int * rate)
     }
 
     stored_channels = * channels;
+    stored_rate = new_rate;
     ratio = (double) new_rate / * rate;
     * rate = new_rate;
 }
 
-void do_resample (float * * data, int * samples)
+static void enlarge_buffer (size_t samples)
 {
-    if (! soxr)
-         return;
-
-    if (buffer_samples < (int) (* samples * ratio) + 256)
+    if (buffer_samples < samples)
     {
-        buffer_samples = (int) (* samples * ratio) + 256;
+        buffer_samples = samples;
         buffer = realloc (buffer, sizeof (float) * buffer_samples);
     }
+}
+
+void do_resample (float * * data, int * samples, bool_t finish)
+{
+    if (! soxr)
+         return;
 
-    size_t samples_done;
+    enlarge_buffer ((int) (* samples * ratio) + 256);
+
+    size_t frames_done, frames = 0;
 
     error = soxr_process(soxr, * data, * samples / stored_channels, NULL,
-        buffer, buffer_samples / stored_channels, & samples_done);
+        buffer, buffer_samples / stored_channels, & frames_done);
 
     if (error)
     {
@@ -111,24 +124,57 @@ void do_resample (float * * data, int * samples)
         return;
     }
 
+    frames += frames_done;
+
+    /* At the end of the song, signal end of input and collect whatever is
+     * still held in the filter, until libsoxr has nothing more to give. */
+    while (finish)
+    {
+        enlarge_buffer (stored_channels * (frames + 4096));
+
+        error = soxr_process(soxr, NULL, 0, NULL, buffer + stored_channels *
+            frames, buffer_samples / stored_channels - frames, & frames_done);
+
+        if (error)
+        {
+            RESAMPLER_ERROR (error);
+            break;
+        }
+
+        if (! frames_done)
+            break;
+
+        frames += frames_done;
+    }
+
     * data = buffer;
-    * samples = samples_done * stored_channels;
+    * samples = frames * stored_channels;
 }
 
 void sox_resampler_process (float * * data, int * samples)
 {
-    do_resample (data, samples);
+    do_resample (data, samples, FALSE);
 }
 
 void sox_resampler_flush (void)
 {
-    if (soxr && (error = soxr_process(soxr, NULL, 0, NULL, NULL, 0, NULL)))
+    if (soxr && (error = soxr_clear(soxr)))
         RESAMPLER_ERROR (error);
 }
 
 void sox_resampler_finish (float * * data, int * samples)
 {
-    do_resample (data, samples);
+    do_resample (data, samples, TRUE);
+    sox_resampler_flush ();
+}
+
+int sox_resampler_adjust_delay (int delay)
+{
+    if (! soxr)
+        return delay;
+
+    /* soxr_delay() counts the output frames still pending in the filter */
+    return delay + (int) (soxr_delay(soxr) * 1000 / stored_rate);
 }
 
 static const char sox_resampler_about[] =
@@ -150,7 +196,10 @@ static const PreferencesWidget sox_resampler_widgets[] = {
   .data = {.combo = {method_list, sizeof method_list / sizeof method_list[0]}}},
  {WIDGET_SPIN_BTN, N_("Rate:"),
   .cfg_type = VALUE_INT, .csect = "soxr", .cname = "rate",
-  .data = {.spin_btn = {MIN_RATE, MAX_RATE, RATE_STEP, N_("Hz")}}}
+  .data = {.spin_btn = {MIN_RATE, MAX_RATE, RATE_STEP, N_("Hz")}}},
+ {WIDGET_SPIN_BTN, N_("Threads for surround sound:"),
+  .cfg_type = VALUE_INT, .csect = "soxr", .cname = "threads",
+  .data = {.spin_btn = {1, MAX_THREADS, 1}}}
 };
 
 static const PluginPreferences sox_resampler_prefs = {
@@ -169,5 +218,6 @@ AUD_EFFECT_PLUGIN
     .process = sox_resampler_process,
     .flush = sox_resampler_flush,
     .finish = sox_resampler_finish,
+    .adjust_delay = sox_resampler_adjust_delay,
     .order = 2 /* must be before crossfade */
 )
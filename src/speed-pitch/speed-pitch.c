@@ -28,6 +28,9 @@
 #include <audacious/plugin.h>
 #include <audacious/preferences.h>
 
+#include "dsp/dsp.h"
+#include "dsp/params.h"
+
 /* The general idea of the speed change algorithm is to divide the input signal
  * into pieces, spaced at a time interval A, using a cosine-shaped window
  * function.  The pieces are then reassembled by adding them together again,
@@ -35,11 +38,22 @@
  * speed of the audio.  To get better results at the two ends of a song, we add
  * a short period of silence (half the width of the cosine window, to be exact)
  * to each end of the input signal beforehand and afterwards trim the same
- * amount from each end of the output signal. */
+ * amount from each end of the output signal.
+ *
+ * Optionally (WSOLA), each piece is not cut exactly at its spacing interval
+ * but shifted by up to TOLERANCE of the output interval, to wherever it best
+ * lines up with the audio that naturally followed the previous piece.  This
+ * keeps the waveforms of overlapping pieces in phase and avoids most of the
+ * "phasing" sound of plain overlap-add.  To keep the search cheap, it is done
+ * in coarse steps first and then refined around the best match. */
 
 #define FREQ    10
 #define OVERLAP  3
 
+#define TOLERANCE 8 /* +/- 1/8 of the output interval */
+#define CORRELATE 2 /* compare 1/2 of the output interval */
+#define COARSE    8 /* frames */
+
 #define CFGSECT "speed-pitch"
 #define MINSPEED 0.5
 #define MAXSPEED 2.0
@@ -49,38 +63,69 @@
 #define BYTES(frames) ((frames) * curchans * sizeof (float))
 #define OFFSET(buf,frames) ((buf) + (frames) * curchans)
 
+#define BUFDATA(b) OFFSET ((b)->mem, (b)->start)
+
+/* Audio is appended at the end of each buffer and consumed from the front.
+ * Instead of moving the remaining audio down on every call, only the start
+ * advances; the audio is moved back to the front once it reaches the end of
+ * the memory.  Since the memory is kept at least twice as large as the audio
+ * it holds, each frame is moved at most once on average. */
 typedef struct {
     float * mem;
-    int size, len;
+    int size, start, len;
 } Buffer;
 
 static int curchans, currate;
 static SRC_STATE * srcstate;
-static int outstep, width;
-static double * cosine;
+static int outstep, width, tolerance;
+static float * window;
 static Buffer in, out;
 static int trim, written;
+static int next; /* where the next piece is due to be cut */
+static int natural; /* where the next piece would continue the last, or -1 */
 static bool_t ending;
+static DSPParamStore params, mode_params;
+
+static void update_params (void)
+{
+    DSPParams p = {0};
+    p.f[0] = aud_get_double (CFGSECT, "speed");
+    p.f[1] = aud_get_double (CFGSECT, "pitch");
+    dsp_params_publish (& params, p);
+
+    DSPParams mode = {0};
+    mode.i[0] = aud_get_bool (CFGSECT, "wsola");
+    dsp_params_publish (& mode_params, mode);
+}
 
 static void bufgrow (Buffer * b, int len)
 {
-    if (len > b->size)
+    if (b->start + len > b->size)
     {
-        b->mem = realloc (b->mem, BYTES (len));
-        b->size = len;
+        memmove (b->mem, BUFDATA (b), BYTES (b->len));
+        b->start = 0;
+
+        if (len * 2 > b->size)
+        {
+            b->mem = realloc (b->mem, BYTES (len * 2));
+            b->size = len * 2;
+        }
     }
 
     if (len > b->len)
     {
-        memset (OFFSET (b->mem, b->len), 0, BYTES (len - b->len));
+        memset (OFFSET (BUFDATA (b), b->len), 0, BYTES (len - b->len));
         b->len = len;
     }
 }
 
 static void bufcut (Buffer * b, int len)
 {
-    memmove (b->mem, OFFSET (b->mem, len), BYTES (b->len - len));
+    b->start += len;
     b->len -= len;
+
+    if (! b->len)
+        b->start = 0;
 }
 
 static void bufadd (Buffer * b, float * data, int len, double ratio)
@@ -92,7 +137,7 @@ static void bufadd (Buffer * b, float * data, int len, double ratio)
     SRC_DATA d = {
      .data_in = data,
      .input_frames = len,
-     .data_out = OFFSET (b->mem, oldlen),
+     .data_out = OFFSET (BUFDATA (b), oldlen),
      .output_frames = max,
      .src_ratio = ratio};
 
@@ -104,14 +149,16 @@ static void speed_flush (void)
 {
     src_reset (srcstate);
 
-    in.len = 0;
-    out.len = 0;
+    in.start = in.len = 0;
+    out.start = out.len = 0;
 
     /* Add silence to the beginning of the input signal. */
     bufgrow (& in, width / 2);
 
     trim = width / 2;
     written = 0;
+    next = 0;
+    natural = -1;
     ending = FALSE;
 }
 
@@ -129,20 +176,77 @@ static void speed_start (int * chans, int * rate)
      * output. */
     outstep = currate / FREQ;
     width = outstep * OVERLAP;
+    tolerance = outstep / TOLERANCE;
 
     /* Generate the cosine window, scaled vertically to compensate for the
-     * overlap of the reassembled pieces of audio. */
-    cosine = realloc (cosine, width * sizeof (double));
+     * overlap of the reassembled pieces of audio.  Each value is repeated for
+     * every channel so that a piece can be windowed in a single pass. */
+    window = realloc (window, BYTES (width));
     for (int i = 0; i < width; i ++)
-        cosine[i] = (1.0 - cos (2.0 * M_PI * i / width)) / OVERLAP;
+    {
+        float value = (1.0 - cos (2.0 * M_PI * i / width)) / OVERLAP;
+
+        for (int c = 0; c < curchans; c ++)
+            OFFSET (window, i)[c] = value;
+    }
 
     speed_flush ();
 }
 
+/* Compares the piece of input starting at <pos> with the audio at <natural>,
+ * scaled so that louder pieces are not favored. */
+static float similarity (int pos)
+{
+    const float * a = OFFSET (BUFDATA (& in), pos);
+    const float * b = OFFSET (BUFDATA (& in), natural);
+    int length = outstep / CORRELATE * curchans;
+
+    return dsp_dot (a, b, length) / sqrtf (dsp_dot (a, a, length) + 1e-9f);
+}
+
+/* Finds the best place near <src> to cut the next piece from. */
+static int align_piece (int src)
+{
+    int lo = MAX (src - tolerance, 0);
+    int hi = MIN (src + tolerance, in.len - width);
+
+    int best = src;
+    float best_score = similarity (src);
+
+    for (int pos = lo; pos <= hi; pos += COARSE)
+    {
+        float score = similarity (pos);
+
+        if (score > best_score)
+        {
+            best = pos;
+            best_score = score;
+        }
+    }
+
+    int center = best;
+
+    for (int pos = MAX (center - COARSE + 1, lo); pos <= MIN (center + COARSE
+     - 1, hi); pos ++)
+    {
+        float score = (pos == center) ? best_score : similarity (pos);
+
+        if (score > best_score)
+        {
+            best = pos;
+            best_score = score;
+        }
+    }
+
+    return best;
+}
+
 static void speed_process (float * * data, int * samples)
 {
-    double pitch = aud_get_double (CFGSECT, "pitch");
-    double speed = aud_get_double (CFGSECT, "speed");
+    DSPParams p = dsp_params_read (& params);
+    double speed = p.f[0];
+    double pitch = p.f[1];
+    bool_t wsola = dsp_params_read (& mode_params).i[0];
 
     /* Remove audio that has already been played from the output buffer. */
     bufcut (& out, written);
@@ -157,25 +261,44 @@ static void speed_process (float * * data, int * samples)
     /* Calculate the spacing interval for input. */
     int instep = round (outstep * speed / pitch);
 
-    /* Run the speed change algorithm. */
-    int src = 0;
+    /* Run the speed change algorithm.  When aligning pieces, wait until the
+     * whole search range is available, except at the very end. */
+    int src = next;
     int dst = 0;
+    int margin = (wsola && ! ending) ? tolerance : 0;
+
+    if (! wsola)
+        natural = -1;
 
-    while (src + MAX (width, instep) <= in.len)
+    while (src + margin + MAX (width, instep) <= in.len)
     {
+        int pos = (natural >= 0) ? align_piece (src) : src;
+
         bufgrow (& out, dst + width);
         out.len = dst + width;
 
-        for (int i = 0; i < width; i ++)
-        for (int c = 0; c < curchans; c ++)
-            OFFSET (out.mem, dst + i)[c] += OFFSET (in.mem, src + i)[c] * cosine[i];
+        dsp_mix_mul (OFFSET (BUFDATA (& out), dst), OFFSET (BUFDATA (& in),
+         pos), window, width * curchans);
+
+        if (wsola)
+            natural = pos + outstep;
 
         src += instep;
         dst += outstep;
     }
 
-    /* Remove processed audio from the input buffer. */
-    bufcut (& in, src);
+    /* Remove processed audio from the input buffer, keeping what the search
+     * for the next piece may still need. */
+    int cut = src;
+
+    if (natural >= 0)
+    {
+        cut = MAX (MIN (src - tolerance, natural), 0);
+        natural -= cut;
+    }
+
+    bufcut (& in, cut);
+    next = src - cut;
 
     /* Trim silence from the beginning of the output buffer. */
     if (trim > 0)
@@ -193,7 +316,7 @@ static void speed_process (float * * data, int * samples)
 
     /* Return processed audio in the output buffer and mark it to be removed on
      * the next call. */
-    * data = out.mem;
+    * data = BUFDATA (& out);
     * samples = dst * curchans;
     written = dst;
 }
@@ -212,23 +335,29 @@ static void speed_finish (float * * data, int * samples)
 static int speed_adjust_delay (int delay)
 {
     /* Not sample-accurate, but should be a decent estimate. */
-    double speed = aud_get_double (CFGSECT, "speed");
+    double speed = dsp_params_read (& params).f[0];
     return delay * speed + width * 1000 / currate;
 }
 
 static const char * const speed_defaults[] = {
  "speed", "1",
  "pitch", "1",
+ "wsola", "FALSE",
  NULL};
 
 static const PreferencesWidget speed_widgets[] = {
  {WIDGET_LABEL, N_("<b>Speed and Pitch</b>")},
  {WIDGET_SPIN_BTN, N_("Speed:"),
   .cfg_type = VALUE_FLOAT, .csect = CFGSECT, .cname = "speed",
+  .callback = update_params,
   .data = {.spin_btn = {MINSPEED, MAXSPEED, 0.05}}},
  {WIDGET_SPIN_BTN, N_("Pitch:"),
   .cfg_type = VALUE_FLOAT, .csect = CFGSECT, .cname = "pitch",
-  .data = {.spin_btn = {MINPITCH, MAXPITCH, 0.05}}}};
+  .callback = update_params,
+  .data = {.spin_btn = {MINPITCH, MAXPITCH, 0.05}}},
+ {WIDGET_CHK_BTN, N_("Align overlapping pieces (smoother, uses more CPU)"),
+  .cfg_type = VALUE_BOOLEAN, .csect = CFGSECT, .cname = "wsola",
+  .callback = update_params}};
 
 static const PluginPreferences speed_prefs = {
  .widgets = speed_widgets,
@@ -237,6 +366,7 @@ static const PluginPreferences speed_prefs = {
 static bool_t speed_init (void)
 {
     aud_config_set_defaults (CFGSECT, speed_defaults);
+    update_params ();
     return TRUE;
 }
 
@@ -247,16 +377,16 @@ static void speed_cleanup (void)
 
     srcstate = NULL;
 
-    free (cosine);
-    cosine = NULL;
+    free (window);
+    window = NULL;
 
     free (in.mem);
     in.mem = NULL;
-    in.size = 0;
+    in.size = in.start = 0;
 
     free (out.mem);
     out.mem = NULL;
-    out.size = 0;
+    out.size = out.start = 0;
 }
 
 AUD_EFFECT_PLUGIN
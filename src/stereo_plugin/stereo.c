@@ -7,11 +7,16 @@
 #include <audacious/plugin.h>
 #include <audacious/preferences.h>
 
+#include "dsp/dsp.h"
+#include "dsp/params.h"
+
 static bool_t init (void);
 
 static void stereo_start (int * channels, int * rate);
 static void stereo_process (float * * data, int * samples);
+static void stereo_flush (void);
 static void stereo_finish (float * * data, int * samples);
+static void update_params (void);
 
 static const char stereo_about[] =
  N_("Extra Stereo Plugin\n\n"
@@ -19,13 +24,26 @@ static const char stereo_about[] =
 
 static const char * const stereo_defaults[] = {
  "intensity", "2.5",
+ "crystalizer", "0",
+ "remove_voice", "FALSE",
  NULL};
 
 static const PreferencesWidget stereo_widgets[] = {
  {WIDGET_LABEL, N_("<b>Extra Stereo</b>")},
  {WIDGET_SPIN_BTN, N_("Intensity:"),
   .cfg_type = VALUE_FLOAT, .csect = "extra_stereo", .cname = "intensity",
-  .data = {.spin_btn = {0, 10, 0.1}}}};
+  .callback = update_params,
+  .data = {.spin_btn = {0, 10, 0.1}}},
+ {WIDGET_LABEL, N_("<b>Combined Effects</b>")},
+ {WIDGET_LABEL, N_("These are done in the same pass as Extra Stereo, so the\n"
+  "separate Crystalizer and Voice Removal effects can be turned off.")},
+ {WIDGET_SPIN_BTN, N_("Crystalizer intensity:"),
+  .cfg_type = VALUE_FLOAT, .csect = "extra_stereo", .cname = "crystalizer",
+  .callback = update_params,
+  .data = {.spin_btn = {0, 10, 0.1}}},
+ {WIDGET_CHK_BTN, N_("Remove voice"),
+  .cfg_type = VALUE_BOOLEAN, .csect = "extra_stereo", .cname = "remove_voice",
+  .callback = update_params}};
 
 static const PluginPreferences stereo_prefs = {
  .widgets = stereo_widgets,
@@ -40,40 +58,64 @@ AUD_EFFECT_PLUGIN
     .init = init,
     .start = stereo_start,
     .process = stereo_process,
+    .flush = stereo_flush,
     .finish = stereo_finish,
     .preserves_format = TRUE
 )
 
+/* All three settings are packed into one word, so that the audio thread never
+ * sees a new intensity with an old voice removal flag.  The intensities go in
+ * as fixed point, which is plenty for spin buttons with a step of 0.1. */
+#define PARAM_SCALE 1000
+
+static DSPParamStore params;
+
+static void update_params (void)
+{
+    DSPParams p = {0};
+    p.s[0] = aud_get_double ("extra_stereo", "intensity") * PARAM_SCALE + 0.5;
+    p.s[1] = aud_get_double ("extra_stereo", "crystalizer") * PARAM_SCALE + 0.5;
+    p.s[2] = aud_get_bool ("extra_stereo", "remove_voice");
+    dsp_params_publish (& params, p);
+}
+
 static bool_t init (void)
 {
     aud_config_set_defaults ("extra_stereo", stereo_defaults);
+    update_params ();
     return TRUE;
 }
 
 static int stereo_channels;
+static float stereo_prev[2];
 
 static void stereo_start (int * channels, int * rate)
 {
     stereo_channels = * channels;
+    stereo_flush ();
 }
 
+/* Voice removal leaves only the side signal, doubled and with the channels
+ * swapped, which is the same as giving the side signal a gain of -2. */
+
 static void stereo_process (float * * data, int * samples)
 {
-    float value = aud_get_double ("extra_stereo", "intensity");
-    float * f, * end;
-    float center;
+    DSPParams p = dsp_params_read (& params);
+    float intensity = (float) p.s[0] / PARAM_SCALE;
+    float crystalizer = (float) p.s[1] / PARAM_SCALE;
+    bool_t remove_voice = p.s[2];
+    float side = remove_voice ? -2 * intensity : intensity;
 
     if (stereo_channels != 2 || samples == 0)
         return;
 
-    end = (* data) + (* samples);
+    dsp_stereo (* data, (* samples) / 2, stereo_prev, crystalizer, remove_voice ?
+     0 : 1, side);
+}
 
-    for (f = * data; f < end; f += 2)
-    {
-        center = (f[0] + f[1]) / 2;
-        f[0] = center + (f[0] - center) * value;
-        f[1] = center + (f[1] - center) * value;
-    }
+static void stereo_flush (void)
+{
+    stereo_prev[0] = stereo_prev[1] = 0;
 }
 
 static void stereo_finish (float * * data, int * samples)
@@ -21,6 +21,8 @@
 #include <audacious/i18n.h>
 #include <audacious/plugin.h>
 
+#include "dsp/dsp.h"
+
 static int voice_channels;
 
 static void voice_start(int *channels, int *rate)
@@ -28,24 +30,16 @@ static void voice_start(int *channels, int *rate)
 	voice_channels = *channels;
 }
 
+/* Each channel becomes the other minus itself, that is, the side signal times
+ * -2 with nothing of the mid signal. */
 static void voice_process(float **d, int *samples)
 {
-	float *f = *d, *end;
-	end = *d + *samples;
+	float prev[2] = {0, 0};
 
 	if (voice_channels != 2 || samples == 0)
 		return;
 
-	for (f = *d; f < end; f += 2)
-	{
-		float left, right;
-
-		left = (f[1] - f[0]);
-		right = (f[0] - f[1]);
-
-		f[0] = left;
-		f[1] = right;
-	}
+	dsp_stereo(*d, *samples / 2, prev, 0, 0, -2);
 }
 
 static void voice_finish(float **d, int *samples)